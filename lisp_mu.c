@@ -3,441 +3,3655 @@
 #include <stdlib.h>
 #include <ctype.h>
 
+// Hash tables take their memory where everything else does, see Memory. Each table says what running
+// out means for it by defining uthash_fatal before it adds to the table, see Symbols and Global bindings
+#define uthash_malloc(N)    mem_alloc(N)
+#define uthash_free(P, N)   mem_free(P)
+#include "uthash.h"
+
 const char * ERR_SYMTOOLONG = "Symbol length too long";
 const char * ERR_LISTNOTTERMINATED = "List was not terminated";
+const char * ERR_OUTOFMEMORY = "Out of memory";
+const char * ERR_QUOTA = "Allocation quota exceeded";
 
 #ifdef DEBUG
-char * types[] = {"NIL","CONS","FIXNUM","FLOAT","STRING","SYM","ERROR"};
+char * types[] = {"NIL","CONS","FIXNUM","FLOAT","STRING","SYM","ERROR","FN","CHAR","LEXICAL","FRAME","NODE","CODE","FREE","MOVED"};
 #endif
 
 
 /**
  * ----------------------------------------------------------------------
- * Garbage Collector
+ * Memory
  * ----------------------------------------------------------------------
- * The garbage collect uses the following algo:
- * 1. All list objects are stored in a single list `all_objects'
- * 2. Sweep will scan_aux `all_symbols'
- * 3. recursively mark referenced objects as accessible
- * 4. All unmarked objects as inaccessible and thus can be reclaimed
- *
- * Notes:
- * There is no automatic GC, it is initiated by the host. This is important for
- * devices operating in real-time. This means the responsibility for memory
- * management is on the host, thus the GC may be considered only partuial GC
- *
- * Special objects must be protected, these are created by lisp_init and cleaned up by lisp_cleanup
- * e.g. nil, all_objects, all_symbols
+ * Pages, the nursery, the region arena, string payloads and the reader's buffers all come from
+ * mem_alloc. Normally that is malloc, with WITH_STATIC_HEAP it is a first fit allocator over the block
+ * the host hands to lisp_init, so the interpreter never touches the system heap. Free blocks are kept in
+ * address order and merged with their neighbours when freed.
  *
+ * Running out of memory is not fatal: the allocation returns `oom_cell', an ERROR that evaluation
+ * passes up like any other, and the host can collect and carry on.
  */
-bool lisp_sweep() {
-    return false;
+static lisp_cell oom_cell;
+
+#ifdef WITH_STATIC_HEAP
+
+typedef struct mem_block {
+    size_t size;                // Bytes in the block, this header included
+    struct mem_block *next;     // Next free block in address order, only meaningful while free
+} mem_block;
+
+static mem_block *free_blocks = NULL;
+
+#define mem_round(N)    (((N) + sizeof(mem_block) - 1) / sizeof(mem_block) * sizeof(mem_block))
+
+static void mem_init(void *buffer, size_t size) {
+    uintptr_t start = mem_round((uintptr_t) buffer);
+    free_blocks = NULL;
+    if (size < start - (uintptr_t) buffer + 2 * sizeof(mem_block)) return;
+    free_blocks = (mem_block *) start;
+    free_blocks->size = (size - (start - (uintptr_t) buffer)) / sizeof(mem_block) * sizeof(mem_block);
+    free_blocks->next = NULL;
 }
 
-bool lisp_free(bool force_clean_all) {
-    cell ptr = all_objects;
-    if (force_clean_all) {
-#ifdef DEBUG
-        puts("Delete all objects");
-#endif
-        while(!nullp(ptr)) {
-#ifdef DEBUG
-            puts("=======================");
-            printf("Address to destroy %d, type:%s\n", car(ptr), types[car(ptr)->type]);
-            printf("Name of object: %s\n", car(ptr)->name);
-            printf("all_o: %d, nil: %d, all_sym: %d\n", all_objects, nil, all_symbols);
-            printf("Length of all_objects before %d\n", lisp_length(all_objects));
-            lisp_pprint(all_objects, 0);
-#endif
-            cell tmp = cdr(ptr);
-            lisp_destroy(car(ptr), all_objects);
-            ptr = tmp;
-#ifdef DEBUG
-            printf("Length of all_objects after %d\n", lisp_length(all_objects));
-#endif
+static void *mem_alloc(size_t bytes) {
+    size_t size = mem_round(bytes) + sizeof(mem_block);
+    for (mem_block **link = &free_blocks; *link != NULL; link = &(*link)->next) {
+        mem_block *block = *link;
+        if (block->size < size) continue;
+        if (block->size - size >= 2 * sizeof(mem_block)) {
+            mem_block *tail = (mem_block *) ((char *) block + size);
+            tail->size = block->size - size;
+            tail->next = block->next;
+            *link = tail;
+            block->size = size;
+        } else {
+            *link = block->next;
         }
+        return block + 1;
     }
+    return NULL;
+}
 
-    // Check if !marked
-    return true;
-
+static void mem_free(void *ptr) {
+    if (ptr == NULL) return;
+    mem_block *block = (mem_block *) ptr - 1, *prev = NULL, **link = &free_blocks;
+    while (*link != NULL && *link < block) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    block->next = *link;
+    *link = block;
+    if (block->next != NULL && (char *) block + block->size == (char *) block->next) {
+        block->size += block->next->size;
+        block->next = block->next->next;
+    }
+    if (prev != NULL && (char *) prev + prev->size == (char *) block) {
+        prev->size += block->size;
+        prev->next = block->next;
+    }
 }
 
-cell find_object(cell address, cell objects) {
-    if (!listp(objects)) return nil;
-    cell o = objects;
-    cell result = nil;
-    while(!nullp(o)) {
-        cell test = car(o);
-        if (test == address) {
-            result = o;
-            break;
-        }
-        o = rest(o);
+static void *mem_realloc(void *ptr, size_t bytes) {
+    void *result = mem_alloc(bytes);
+    if (result != NULL && ptr != NULL) {
+        size_t old = ((mem_block *) ptr - 1)->size - sizeof(mem_block);
+        memcpy(result, ptr, old < bytes ? old : bytes);
+        mem_free(ptr);
     }
     return result;
 }
 
+/*
+ * How many objects of `bytes' could still be allocated
+ */
+static size_t mem_fit(size_t bytes) {
+    size_t count = 0, size = mem_round(bytes) + sizeof(mem_block);
+    for (mem_block *block = free_blocks; block != NULL; block = block->next) {
+        count += block->size / size;
+    }
+    return count;
+}
+
+#else
+
+#define mem_alloc(N)        malloc(N)
+#define mem_realloc(P, N)   realloc(P, N)
+#define mem_free(P)         free(P)
+
+#endif // WITH_STATIC_HEAP
+
+
 /**
  * ----------------------------------------------------------------------
- * Evaluation
- *
- * See: https://mitpress.mit.edu/sicp/full-text/book/book-Z-H-26.html
+ * Cell allocator
+ * ----------------------------------------------------------------------
+ * Cells are carved from pages of LISP_PAGE_CELLS. A fresh page is handed out by bumping `page_top', cells
+ * that have been destroyed are marked FREE and pushed onto `free_cells', an intrusive list threaded
+ * through `rest'. The free list is always preferred over the bump pointer so the heap only grows when it
+ * is really exhausted.
  *
+ * The pages are also the registry of every object: walking them, skipping FREE cells and the unused tail
+ * of the newest page, visits the whole heap in address order.
  */
+typedef struct lisp_page {
+    struct lisp_page *next;
+    lisp_cell cells[LISP_PAGE_CELLS];
+} lisp_page;
 
-cell eval(cell exp, cell env) {
-    if (errorp(exp))            return exp;
-    if (self_evaluatingp(exp))  return exp;
-    if (variablep(exp))         return lookup_variable_value(exp, env);
-    if (quotedp(exp))           return cadr(exp);
-    if (assignmentp(exp))       return eval_assignment(exp, env);
-    if (definitionp(exp))       return eval_definition(exp, env);
-    if (ifp(exp))               return eval_if(exp, env);
-    if (lambdap(exp))
-        return mkprocedure(lambda_parameters(exp),
-                           lambda_body(exp), env);
-    if (beginp(exp))            return eval_sequence(begin_actions(exp), env);
-    if (condp(exp))             return eval(cond_if(exp), env);
-    if (applicationp(exp))
-        return apply(eval(operator(exp), env),
-                     (list_of_values(operands(exp), env)));
-    return mkerror("Unknown expression type -- EVAL");
-}
+static lisp_page *heap_pages = NULL;     // Most recently allocated page first
+static size_t     page_top   = LISP_PAGE_CELLS;
+static cell       free_cells = NULL;
+static size_t     free_count = 0;
+static size_t     page_count = 0;
 
-cell list_of_values(cell exps, cell env) {
-    if (no_operandsp(exps))
-        return nil;
-    else
-        return cons(eval(first_operand(exps), env),
-                    list_of_values(rest_operands(exps), env));
+#define page_alloc()    ((lisp_page *) mem_alloc(sizeof(lisp_page)))
+#define page_free(P)    mem_free(P)
+
+/*
+ * Pages that can still be allocated
+ */
+static size_t spare_pages() {
+#ifdef WITH_STATIC_HEAP
+    return mem_fit(sizeof(lisp_page));
+#else
+    return SIZE_MAX / sizeof(lisp_page);
+#endif
 }
 
-bool falsep(cell exp) {
-    return lisp_eq(exp, FALSE) || nullp(exp);
+static cell cell_alloc() {
+    cell result = free_cells;
+    if (result != NULL) {
+        free_cells = result->rest;
+        free_count--;
+        return result;
+    }
+
+    if (page_top == LISP_PAGE_CELLS) {
+        lisp_page *page = page_alloc();
+        if (page == NULL) return NULL;
+        page->next = heap_pages;
+        heap_pages = page;
+        page_top = 0;
+        page_count++;
+    }
+    return &heap_pages->cells[page_top++];
 }
 
-bool truep(cell exp) {
-    return !falsep(exp);
+static void cell_free(cell c) {
+    c->type = FREE;
+    c->rest = free_cells;
+    free_cells = c;
+    free_count++;
 }
 
-cell eval_if(cell exp, cell env) {
-    if (truep(eval(if_predicate(exp), env)))
-        return eval(if_consequent(exp), env);
-    else
-        return eval(if_alternate(exp), env);
+/*
+ * Cells that can still be allocated without asking the system for more memory
+ */
+static size_t heap_headroom() {
+#ifdef WITH_STATIC_HEAP
+    return free_count + (LISP_PAGE_CELLS - page_top) + spare_pages() * LISP_PAGE_CELLS;
+#else
+    return SIZE_MAX;
+#endif
 }
 
-cell eval_sequence(cell exps, cell env) {
-    if(last_expp(exps))
-        return eval(first_exp(exps), env);
-    else {
-        eval(first_exp(exps), env);
-        return eval_sequence(rest_exps(exps), env);
+/*
+ * Return every page to the system (or the static buffer), any cells still in use are lost
+ */
+static void heap_release() {
+    while (heap_pages != NULL) {
+        lisp_page *next = heap_pages->next;
+        page_free(heap_pages);
+        heap_pages = next;
     }
+    page_top   = LISP_PAGE_CELLS;
+    free_cells = NULL;
+    free_count = 0;
+    page_count = 0;
 }
 
-cell eval_assignment(cell exp, cell env) {
-    cell result = set_variable_valueb(assignment_variable(exp), eval(assignment_value(exp), env), env);
-    if (result -> type == ERROR)
-        return result;
-    else
-        return lisp_true;
+size_t lisp_heap_pages() {
+    return page_count;
 }
 
-cell eval_definition(cell exp, cell env) {
-    define_variableb(definition_variable(exp), eval(definition_value(exp), env), env);
-    return lisp_true;
+// Cells of a page that have been handed out, only the newest page can be partially used
+#define page_used(P)            ((P) == heap_pages ? page_top : LISP_PAGE_CELLS)
+#define page_containsp(P, C)    ((C) >= (P)->cells && (C) < (P)->cells + page_used(P))
+
+/**
+ * Nursery
+ * Cells without a payload (conses, numbers, characters and functions) and frames are bump allocated from
+ * the nursery while it has room, everything else and the overflow of a full nursery come from the pages.
+ * The nursery is only emptied by a minor collection, which copies its survivors into the pages and
+ * frees the vectors of the frames that died. Destroying a nursery cell just marks it FREE, the space
+ * comes back with the next minor collection.
+ */
+static size_t     nursery_cells = 0;
+static size_t     nursery_top   = 0;
+static size_t     nursery_freed = 0;   // Cells destroyed by the host since the last minor collection
+
+#define nursery_typep(T)    ((T) == CONS || (T) == FIXNUM || (T) == FLOAT || (T) == CHAR || (T) == FN || \
+                             (T) == FRAME)
+
+/*
+ * A static heap gives at most an eighth of itself to the nursery
+ */
+static void nursery_init(size_t heap_size) {
+    nursery_cells = heap_size / 8 / sizeof(lisp_cell);
+    if (nursery_cells > LISP_NURSERY_CELLS) nursery_cells = LISP_NURSERY_CELLS;
+    lisp_nursery = mem_alloc(sizeof(lisp_cell) * nursery_cells);
+    if (lisp_nursery == NULL) nursery_cells = 0;
+    lisp_nursery_end = lisp_nursery + nursery_cells;
+    nursery_top = nursery_freed = 0;
 }
 
-cell mkprocedure(cell parameters, cell body, cell env) {
-    return mklist(4, procedure, parameters, body, env);
+static void nursery_release() {
+    mem_free(lisp_nursery);
+    lisp_nursery = lisp_nursery_end = NULL;
+    nursery_cells = nursery_top = nursery_freed = 0;
 }
 
-cell add_binding_to_frameb(cell var, cell val, cell frame) {
-    setcarb(frame, cons(var, car(frame)));
-    return setcdrb(frame, cons(val, cdr(frame)));
+static cell nursery_alloc() {
+    if (nursery_top == nursery_cells) return NULL;
+    return &lisp_nursery[nursery_top++];
 }
 
-cell sum(cell parms) {
-    cell c = parms;
-    cell result = mkfixnum(0);
-    while(!nullp(c)) {
-        *(result->fixnum) += fixnum(car(c));
-        c = rest(c);
-    }
+/**
+ * Region arena
+ * Between lisp_region_begin and lisp_region_end every cell but a symbol, together with its string payload
+ * or frame vector, is bump allocated from a single block of LISP_REGION_BYTES. Once the block is full
+ * allocation carries on in the pages. Arena cells are never freed one by one, the whole block is reset at the end of the region.
+ */
+static size_t     arena_top = 0;
+static bool       region_active = false;
+
+#define arena_align(N)      (((N) + sizeof(double) - 1) & ~(sizeof(double) - 1))
+#define payload_typep(T)    ((T) == STRING || (T) == SYM || (T) == ERROR)
+#define ARENA_UNITS         (LISP_REGION_BYTES / sizeof(double))
+#define arena_startp(U)     (arena_starts[(U) / 8] & (1 << (U) % 8))
+
+// A bit per arena_align unit, set where a cell starts, so that the collector can walk the arena
+static unsigned char arena_starts[(ARENA_UNITS + 7) / 8];
+
+static cell arena_alloc(enum lisp_type type, size_t length) {
+    size_t size = arena_align(sizeof(lisp_cell) + (payload_typep(type) || type == FRAME ? length : 0));
+    if (arena_top + size > LISP_REGION_BYTES) return NULL;
+    cell result = (cell) (lisp_arena + arena_top);
+    arena_starts[arena_top / sizeof(double) / 8] |= 1 << arena_top / sizeof(double) % 8;
+    arena_top += size;
     return result;
 }
 
-cell product(cell parms) {
-    cell c = parms;
-    cell result = mkfixnum(1);
-    while(!nullp(c)) {
-        *(result->fixnum) *= fixnum(car(c));
-        c = rest(c);
+/*
+ * Drop everything in the arena at once
+ */
+static void arena_reset() {
+    memset(arena_starts, 0, (arena_top / sizeof(double) + 7) / 8);
+    arena_top = 0;
+    lisp_arena_end = lisp_arena;
+}
+
+/**
+ * Frame vectors
+ * The values of a FRAME live in a lisp_frame from mem_alloc, sized for the call and only grown by an
+ * internal define. Frames come and go with every procedure call, so a vector of up to FRAME_POOL_SLOTS
+ * slots is not given back when its frame dies but kept on a free list for its size and handed to the
+ * next call of that arity. The pools are emptied should mem_alloc fail, and by lisp_cleanup.
+ *
+ * A frame made in a region has its vector in the arena, right after the cell. Should it grow the larger
+ * vector comes from mem_alloc, the frame is then listed in `arena_frames' so that the vector is freed
+ * at the end of the region unless the frame was evacuated.
+ */
+#define FRAME_POOL_SLOTS    8
+#define frame_bytes(N)      (sizeof(lisp_frame) + sizeof(cell) * (N))
+
+static lisp_frame *frame_pool[FRAME_POOL_SLOTS + 1];
+
+static void frame_pool_release() {
+    for (size_t size = 0; size <= FRAME_POOL_SLOTS; ++size) {
+        while (frame_pool[size] != NULL) {
+            lisp_frame *next = frame_pool[size]->next;
+            mem_free(frame_pool[size]);
+            frame_pool[size] = next;
+        }
     }
-    return result;
 }
 
-cell subtract(cell parms) {
-    cell c = parms;
-    cell result = mkfixnum(fixnum(car(parms)));
-    c = rest(c);
-    while(!nullp(c)) {
-        *(result->fixnum) -= fixnum(car(c));
-        c = rest(c);
+static lisp_frame *frame_alloc(size_t size) {
+    lisp_frame *vector = size <= FRAME_POOL_SLOTS ? frame_pool[size] : NULL;
+    if (vector != NULL) {
+        frame_pool[size] = vector->next;
+    } else if ((vector = mem_alloc(frame_bytes(size))) == NULL) {
+        frame_pool_release();
+        if ((vector = mem_alloc(frame_bytes(size))) == NULL) return NULL;
     }
-    return result;
+    vector->names = nil;
+    vector->size = size;
+    vector->count = 0;
+    return vector;
 }
 
-cell divide(cell parms) {
-    cell c = parms;
-    cell result = mkfixnum(fixnum(car(parms)));
-    c = rest(c);
-    while(!nullp(c)) {
-        *(result->fixnum) /= fixnum(car(c));
-        c = rest(c);
+static void frame_free(lisp_frame *vector) {
+    if (vector->size <= FRAME_POOL_SLOTS) {
+        vector->next = frame_pool[vector->size];
+        frame_pool[vector->size] = vector;
+    } else {
+        mem_free(vector);
     }
-    return result;
 }
 
-cell equals(cell parms) {
-    cell lhs = first(parms);
-    cell rhs = second(parms);
-    if (lhs == rhs) return lisp_true;
-    switch (lhs->type) {
-        case NIL:
-            if (rhs->type == NIL) return lisp_true;
-            break;
-        case FIXNUM:
-            if (rhs->type == FIXNUM && fixnum(lhs) == fixnum(rhs)) return lisp_true;
-            break;
-#ifdef WITH_FLOATING_POINT
-        case FLOAT:break;
-#endif
-        case STRING:
-        case SYM:
-        case ERROR:
-            if (lisp_equals(lhs, rhs)) return lisp_true;
-        case CONS:break;
-        case FN:break;
+typedef struct arena_frame {
+    cell frame;
+    struct arena_frame *next;
+} arena_frame;
+
+static arena_frame *arena_frames = NULL;
+
+static bool arena_frame_add(cell frame) {
+    arena_frame *entry = mem_alloc(sizeof(arena_frame));
+    if (entry == NULL) return false;
+    entry->frame = frame;
+    entry->next = arena_frames;
+    arena_frames = entry;
+    return true;
+}
+
+/*
+ * Free the vectors of the listed frames that stay behind in the arena, an evacuated copy owns its own
+ */
+static void arena_frames_release() {
+    while (arena_frames != NULL) {
+        arena_frame *next = arena_frames->next;
+        if (arena_frames->frame->type != MOVED) frame_free(frame_vector(arena_frames->frame));
+        mem_free(arena_frames);
+        arena_frames = next;
     }
-    return nil;
 }
 
-cell printer(cell params) {
-    cell c = params;
-    while(!nullp(c)) {
-        cell val = car(c);
-        switch (val->type) {
-            case NIL: printf("NIL"); break;
-            case FIXNUM: printf("%li", fixnum(val)); break;
-#ifdef WITH_FLOATING_POINT
-            case FLOAT: printf("%f", floater(val)); break;
-#endif
-            case SYM:
-                printf("<#SYM: %s>", symbol(val));
-                break;
-            case STRING:
-            case ERROR:
-                printf(val->string);
-                break;
-            case FN:
-            case CONS:
-                printf("<?>");
-                break;
+/*
+ * Free the vectors of the young frames that were not promoted, before the nursery is reset. Returns the
+ * bytes they took.
+ */
+static size_t nursery_free_frames() {
+    size_t bytes = 0;
+    for (size_t i = 0; i < nursery_top; ++i) {
+        cell c = &lisp_nursery[i];
+        if (c->type != FRAME) continue;
+        bytes += frame_bytes(frame_vector(c)->size);
+        frame_free(frame_vector(c));
+    }
+    return bytes;
+}
+
+/**
+ * Symbols
+ * Symbols are interned: mksym and the reader look the name up in `symbols' and only make a cell the
+ * first time it is seen, so a name is stored once however often it is read and two symbols are equal
+ * exactly when they are the same cell. lisp_init interns the names of the special forms, letting the
+ * evaluator recognise them by comparing pointers.
+ *
+ * The table does not keep its symbols alive, a symbol nothing refers to is collected like any other
+ * object and leaves the table when it is destroyed. Symbols are never allocated in the nursery or the
+ * arena, so only compaction moves them.
+ */
+typedef struct symbol_entry {
+    cell sym;                   // Keyed by the symbol's name, which is its payload
+    UT_hash_handle hh;
+} symbol_entry;
+
+static symbol_entry *symbols = NULL;
+
+/*
+ * uthash ran out of memory. If it was making the table for the first symbol the half made table is
+ * dropped, if it was growing the buckets the symbol is in the table already and nothing is lost.
+ */
+static cell intern_oom() {
+    if (symbols != NULL && (symbols->hh.tbl == NULL || symbols->hh.tbl->buckets == NULL)) {
+        symbol_entry *entry = symbols;
+        symbols = NULL;
+        mem_free(entry->hh.tbl);
+        lisp_destroy(entry->sym);
+        mem_free(entry);
+    }
+    return &oom_cell;
+}
+
+#undef  uthash_fatal
+#define uthash_fatal(M)     return intern_oom()
+
+static cell intern_add(cell sym) {
+    symbol_entry *entry = mem_alloc(sizeof(symbol_entry));
+    if (entry == NULL) {
+        lisp_destroy(sym);
+        return &oom_cell;
+    }
+    entry->sym = sym;
+    HASH_ADD_KEYPTR(hh, symbols, sym->symbol, strlen(sym->symbol), entry);
+    return sym;
+}
+
+/*
+ * Take a symbol that is being destroyed out of the table
+ */
+static void intern_forget(cell sym) {
+    symbol_entry *entry;
+    HASH_FIND_STR(symbols, sym->symbol, entry);
+    if (entry == NULL || entry->sym != sym) return;
+    HASH_DEL(symbols, entry);
+    mem_free(entry);
+}
+
+/*
+ * Point the table at the copies once compaction has moved every live symbol
+ */
+static void intern_forward() {
+    symbol_entry *entry, *tmp;
+    HASH_ITER(hh, symbols, entry, tmp) {
+        if (entry->sym->type == MOVED) {
+            entry->sym = entry->sym->adata;
+        } else {
+            HASH_DEL(symbols, entry);   // Unreachable, its page is about to go
+            mem_free(entry);
         }
-        c = rest(c);
     }
-    return nil;
 }
 
-cell primitive_procedure_names() {
-    cell c[] = {
-            mksym("+"),
-            mksym("-"),
-            mksym("*"),
-            mksym("/"),
-            mksym("="),
-            mksym("print")
-    };
+static void intern_release() {
+    symbol_entry *entry, *tmp;
+    HASH_ITER(hh, symbols, entry, tmp) {
+        HASH_DEL(symbols, entry);
+        mem_free(entry);
+    }
+}
 
-    return mklist_from_array(N_ELEMENTS(c), c);
+/**
+ * Global bindings
+ * The first frame of global_env holds every primitive and top level definition, walking its lists gets
+ * slower with each one. `bindings' indexes it by symbol: an entry points at the cons of the values list
+ * whose car is the symbol's value, so lookup, assignment and definition are O(1) while the frame itself
+ * stays as it was for everything else. The index is built on first use and simply dropped when a
+ * collection may have moved what it points at: compaction, or a minor collection or the end of a region
+ * while a binding or global_env itself was young or in the arena. It is built again the next time.
+ *
+ * Only bindings found through the index are held by the inline caches of Lexical addressing. Assigning
+ * or redefining one that is cached, or dropping the index, bumps `globals_version' and so empties every
+ * cache at once.
+ */
+typedef struct binding_entry {
+    cell var;                   // Interned, so the symbol's address is the key
+    cell vals;                  // car is the value
+    bool cached;                // The value may be held by an inline cache
+    UT_hash_handle hh;
+} binding_entry;
+
+static binding_entry *bindings = NULL;
+static cell bindings_env = NULL;        // The environment indexed, NULL if the index must be built
+static bool bindings_movable = false;   // Something the index points at may be moved by a minor collection or region
+static uint32_t globals_version = 1;    // Inline caches stamped with another version are stale, never 0
+
+#define bindings_movablep(C)    (lisp_youngp(C) || lisp_arenap(C))
+
+static void globals_changed() {
+    if (++globals_version == 0) globals_version = 1;
 }
 
-cell primitive_procedure_objects() {
-    cell c[] = {
-            mkfn("+", &sum),
-            mkfn("-", &subtract),
-            mkfn("*", &product),
-            mkfn("/", &divide),
-            mkfn("=", &equals),
-            mkfn("print", &printer)
-    };
+static void bindings_release() {
+    if (bindings_env != NULL) globals_changed();
+    binding_entry *entry, *tmp;
+    HASH_ITER(hh, bindings, entry, tmp) {
+        HASH_DEL(bindings, entry);
+        mem_free(entry);
+    }
+    bindings_env = NULL;
+    bindings_movable = false;
+}
+
+/*
+ * uthash ran out of memory, as for the symbols. Lookups carry on through the frame's lists.
+ */
+static bool bindings_oom() {
+    if (bindings != NULL && (bindings->hh.tbl == NULL || bindings->hh.tbl->buckets == NULL)) {
+        mem_free(bindings->hh.tbl);
+        mem_free(bindings);
+        bindings = NULL;
+    }
+    bindings_release();
+    return false;
+}
+
+#undef  uthash_fatal
+#define uthash_fatal(M)     return bindings_oom()
+
+static bool bindings_add(cell var, cell vals) {
+    binding_entry *entry = mem_alloc(sizeof(binding_entry));
+    if (entry == NULL) return bindings_oom();
+    entry->var = var;
+    entry->vals = vals;
+    entry->cached = false;
+    HASH_ADD_PTR(bindings, var, entry);
+    bindings_movable |= bindings_movablep(vals);
+    return true;
+}
+
+/*
+ * The index of `env', if it is global_env and one could be built
+ */
+static bool bindings_indexp(cell env) {
+    if (env != global_env || framep(env)) return false;
+    if (bindings_env == env) return true;
+
+    bindings_release();
+    cell frame = first_frame(env);
+    binding_entry *entry;
+    for (cell vars = frame_variables(frame), vals = frame_values(frame); !nullp(vars);
+         vars = cdr(vars), vals = cdr(vals)) {
+        cell var = car(vars);
+        HASH_FIND_PTR(bindings, &var, entry);
+        // The first binding of a name shadows any later one, as in the lists
+        if (entry == NULL && !bindings_add(var, vals)) return false;
+    }
+    bindings_env = env;
+    bindings_movable |= bindings_movablep(env) || bindings_movablep(frame);
+    return true;
+}
+
+static binding_entry *bindings_find(cell var) {
+    binding_entry *entry;
+    HASH_FIND_PTR(bindings, &var, entry);
+    return entry;
+}
+
+static cell bindings_set(binding_entry *entry, cell val) {
+    if (entry->cached) globals_changed();
+    return setcarb(entry->vals, val);
+}
+
+/*
+ * Give a live cell back, to the free list or, for a nursery cell, to the next minor collection
+ */
+static void cell_release(cell c) {
+    if (lisp_arenap(c)) {
+        c->type = FREE;
+    } else if (lisp_youngp(c)) {
+        nursery_freed++;
+        c->type = FREE;
+    } else {
+        cell_free(c);
+    }
+}
+
+size_t lisp_object_count() {
+    size_t count = nursery_top - nursery_freed;
+    for (lisp_page *page = heap_pages; page != NULL; page = page->next) {
+        for (size_t i = 0; i < page_used(page); ++i) {
+            if (page->cells[i].type != FREE) count++;
+        }
+    }
+    return count;
+}
+
+
+/**
+ * ----------------------------------------------------------------------
+ * Garbage Collector
+ * ----------------------------------------------------------------------
+ * The garbage collect uses the following algo:
+ * 1. All list objects live in the cell pages, see the cell allocator
+ * 2. Mark every object reachable from `global_env', the specials and the roots registered by the host
+ * 3. Sweep the pages, all unmarked objects are inaccessible and thus can be reclaimed
+ *
+ * Marking uses a fixed size stack rather than C recursion. Should the stack overflow, the cells that
+ * could not be pushed are still marked but their children are not; the pages, the nursery and the arena
+ * are then rescanned for marked cells with unmarked children until nothing new is marked. Circular
+ * structures terminate because marked cells are never pushed twice.
+ *
+ * Incremental collection
+ * The collector is a tri-colour state machine driven by lisp_gc_step, each step does at most `budget'
+ * units of work (a cell scanned or swept, or a page rescanned) so that it fits between the host's
+ * deadlines. White cells have `marked' != gc_black, grey cells are marked and on the mark stack, black
+ * cells are marked and scanned. Flipping gc_black at the start of a cycle whitens the whole heap at once.
+ *
+ * The host may evaluate between steps, so:
+ * - cells are allocated black, a cycle never reclaims what was created during it
+ * - while marking, setcarb/setcdrb (and so add_binding_to_frameb) shade the stored value grey, as does
+ *   cons for its car and cdr, so a black cell never ends up pointing at a white one
+ * - the roots are marked again once the grey set is empty, catching C variables that changed
+ *
+ * Generational collection
+ * Most cells die young, so lisp_gc_minor only looks at the nursery. Its roots are the host's roots,
+ * the specials, the mark stack and the remembered set: the old cells the write barrier saw being made to
+ * point into the nursery. Every young cell reachable from these is copied into the pages and left
+ * behind as a MOVED forwarding cell, the copies are then scanned in turn (Cheney style, the work list
+ * is threaded through the forwarding cells) and finally the whole nursery is reset in one go. The cost
+ * is proportional to the survivors and not to what was allocated. Promoted cells are black, or grey
+ * while an incremental cycle is marking, so a major cycle in progress carries on unaffected.
+ * Should the remembered set overflow the minor collection scans every page for pointers into the nursery.
+ *
+ * Compaction
+ * Sweeping leaves holes, after a long uptime a list's cells are spread over many pages. lisp_compact
+ * copies every live object into fresh pages and releases the old ones. Each list is copied spine first,
+ * cdr after cdr, so walking it touches consecutive cells; cars are copied afterwards from a work list
+ * threaded through the forwarding cells, as in a minor collection.
+ *
+ * Notes:
+ * There is no automatic GC, it is initiated by the host. This is important for
+ * devices operating in real-time. This means the responsibility for memory
+ * management is on the host, thus the GC may be considered only partuial GC.
+ * Any object held only by a C variable must be registered with lisp_gc_root before collecting.
+ *
+ * Special objects must be protected, these are created by lisp_init and cleaned up by lisp_cleanup
+ * e.g. nil
+ *
+ */
+enum gc_phase { GC_IDLE, GC_MARK, GC_SWEEP };
+
+static cell  *gc_roots[LISP_GC_ROOTS];
+static size_t gc_root_count = 0;
+static cell   mark_stack[LISP_MARK_STACK];
+static size_t mark_top = 0;
+static bool   mark_overflow = false;
+static cell   remembered[LISP_REMEMBERED];
+static size_t remembered_count = 0;
+static bool   remembered_overflow = false;
+
+static enum gc_phase gc_phase = GC_IDLE;
+static bool          gc_black = true;           // Value of `marked' for black and grey cells this cycle
+static lisp_page    *gc_page = NULL;            // Page being rescanned or swept
+static size_t        gc_index = 0;              // Next cell of gc_page to sweep
+static bool          gc_rescanning = false;
+static bool          gc_rescan_young = false;   // The nursery and the arena are still to be rescanned
+static lisp_gc_stats gc_cycle = {0, 0};         // Reclaimed so far by the current cycle
+static lisp_gc_stats gc_last_cycle = {0, 0};    // Reclaimed by the last completed cycle
+
+#define gc_blackp(C)    ((C)->marked == gc_black)
+
+// Made by lisp_init and kept until lisp_cleanup, every collection starts from these
+static cell *const specials[] = {
+    &nil, &lisp_true, &lisp_quote, &lisp_setb, &lisp_define, &lisp_lambda, &lisp_if, &lisp_begin,
+    &lisp_cond, &lisp_else, &lisp_false, &procedure, &lisp_primitive, &lisp_define_macro, &lisp_macro,
+    &the_empty_environment, &global_env
+};
+
+bool lisp_gc_root(cell *root) {
+    if (gc_root_count >= LISP_GC_ROOTS) return false;
+    gc_roots[gc_root_count++] = root;
+    if (lisp_gc_marking) lisp_gc_shade(*root);
+    return true;
+}
+
+void lisp_gc_unroot(cell *root) {
+    for (size_t i = 0; i < gc_root_count; ++i) {
+        if (gc_roots[i] == root) {
+            gc_roots[i] = gc_roots[--gc_root_count];
+            return;
+        }
+    }
+}
+
+/*
+ * Mark a white cell grey, returns false if it was already marked
+ */
+static bool gc_mark(cell c) {
+    if (immediatep(c) || gc_blackp(c)) return false;
+    c->marked = gc_black;
+    if (mark_top < LISP_MARK_STACK)
+        mark_stack[mark_top++] = c;
+    else
+        mark_overflow = true;
+    return true;
+}
+
+void lisp_gc_shade(cell c) {
+    gc_mark(c);
+}
+
+void lisp_gc_remember(cell c) {
+    c->remembered = true;
+    if (remembered_count < LISP_REMEMBERED)
+        remembered[remembered_count++] = c;
+    else
+        remembered_overflow = true;
+}
+
+static void node_forward(lisp_node *node, cell (*forward)(cell));
+static void node_free(lisp_node *node);
+static size_t node_bytes(lisp_node *node);
+static size_t code_bytes(lisp_code *code);
+
+/*
+ * Replace every cell the payload of a FRAME, a NODE or a CODE refers to by what `forward' returns for it
+ */
+static void payload_forward(cell c, cell (*forward)(cell)) {
+    if (c->type == FRAME) {
+        lisp_frame *vector = frame_vector(c);
+        vector->names = forward(vector->names);
+        for (size_t i = 0; i < vector->count; ++i) vector->slots[i] = forward(vector->slots[i]);
+    } else if (c->type == NODE) {
+        node_forward(c->data, forward);
+    } else if (c->type == CODE) {
+        lisp_code *code = c->data;
+        for (size_t i = 0; i < code->count; ++i) code->constants[i] = forward(code->constants[i]);
+    }
+}
+
+static cell gc_mark_forward(cell c) {
+    gc_mark(c);
+    return c;
+}
+
+static void gc_mark_children(cell c) {
+    if (c->type == FREE) return;    // Destroyed by the host while grey
+    if (c->type == CONS || c->type == NIL) gc_mark(c->adata);
+    payload_forward(c, gc_mark_forward);
+    gc_mark(c->rest);
+}
+
+static bool gc_mark_roots() {
+    bool marked = false;
+    for (size_t i = 0; i < N_ELEMENTS(specials); ++i) {
+        marked |= gc_mark(*specials[i]);
+    }
+    for (size_t i = 0; i < gc_root_count; ++i) {
+        marked |= gc_mark(*gc_roots[i]);
+    }
+    return marked;
+}
+
+static size_t payload_size(cell c) {
+    switch (c->type) {
+        case STRING:
+        case SYM:
+        case ERROR:
+            return c->data == nil ? 0 : string_size(strlen(c->string));
+        case FRAME:
+            return frame_bytes(frame_vector(c)->size);
+        case NODE:
+            return node_bytes(c->data);
+        case CODE:
+            return code_bytes(c->data);
+        default:
+            return 0;
+    }
+}
+
+static void gc_start() {
+    gc_black = !gc_black;
+    gc_phase = GC_MARK;
+    lisp_gc_marking = true;
+    gc_rescanning = false;
+    gc_cycle.objects = gc_cycle.bytes = 0;
+    gc_mark_roots();
+}
+
+static void gc_rescan_cell(cell c) {
+    if (c->type != FREE && gc_blackp(c)) gc_mark_children(c);
+}
+
+/*
+ * Rescan one page for black cells whose children could not be pushed when the mark stack overflowed.
+ * Young and arena cells are marked too, once the pages are done the nursery and the arena are rescanned
+ * in one go.
+ */
+static size_t gc_rescan_page() {
+    if (!gc_rescanning) {
+        gc_rescanning = true;
+        gc_rescan_young = true;
+        mark_overflow = false;
+        gc_page = heap_pages;
+    }
+    if (gc_page != NULL) {
+        size_t used = page_used(gc_page);
+        for (size_t i = 0; i < used; ++i) gc_rescan_cell(&gc_page->cells[i]);
+        gc_page = gc_page->next;
+        return used;
+    }
+    if (gc_rescan_young) {
+        gc_rescan_young = false;
+        size_t work = nursery_top;
+        for (size_t i = 0; i < nursery_top; ++i) gc_rescan_cell(&lisp_nursery[i]);
+        for (size_t unit = 0; unit < arena_top / sizeof(double); ++unit) {
+            if (!arena_startp(unit)) continue;
+            gc_rescan_cell((cell) (lisp_arena + unit * sizeof(double)));
+            work++;
+        }
+        return work;
+    }
+    gc_rescanning = false;
+    return 0;
+}
+
+static void gc_sweep_cell() {
+    if (gc_index >= page_used(gc_page)) {
+        gc_page = gc_page->next;
+        gc_index = 0;
+        return;
+    }
+    cell c = &gc_page->cells[gc_index++];
+    if (c->type == FREE || gc_blackp(c)) return;
+    gc_cycle.objects++;
+    gc_cycle.bytes += sizeof(lisp_cell) + payload_size(c);
+    lisp_destroy(c);
+}
+
+bool lisp_gc_step(size_t budget) {
+    if (gc_phase == GC_IDLE) gc_start();
+
+    while (budget > 0) {
+        if (gc_phase == GC_MARK) {
+            if (mark_top > 0) {
+                gc_mark_children(mark_stack[--mark_top]);
+                budget--;
+            } else if (mark_overflow || gc_rescanning) {
+                size_t work = gc_rescan_page();
+                budget -= work < budget ? work : budget;
+            } else if (!gc_mark_roots()) {
+                // Nothing grey and the roots are all black, everything white is garbage
+                gc_phase = GC_SWEEP;
+                lisp_gc_marking = false;
+                gc_page = heap_pages;
+                gc_index = 0;
+            }
+        } else {
+            if (gc_page == NULL) {
+                gc_phase = GC_IDLE;
+                gc_last_cycle = gc_cycle;
+                return true;
+            }
+            gc_sweep_cell();
+            budget--;
+        }
+    }
+    return false;
+}
+
+lisp_gc_stats lisp_gc_cycle_stats() {
+    return gc_last_cycle;
+}
+
+/*
+ * Copy `c' into the pages and leave a forwarding cell behind, pushed onto `work'. The copy is black, or
+ * grey while an incremental cycle is marking so that its children still get marked. Out of memory the
+ * reference is replaced by the out of memory error.
+ */
+static cell gc_move(cell c, cell *work) {
+    cell copy = cell_alloc();
+    if (copy == NULL) return &oom_cell;
+    *copy = *c;
+    copy->remembered = false;
+    copy->marked = !gc_black;
+    if (gc_phase == GC_MARK)
+        gc_mark(copy);
+    else
+        copy->marked = gc_black;
+
+    c->type = MOVED;
+    c->adata = copy;
+    c->rest = *work;
+    *work = c;
+    return copy;
+}
+
+static cell   promoted = NULL;     // Forwarding cells whose copy is still to be scanned, linked by `rest'
+static size_t promoted_count = 0;
+
+/*
+ * Returns where `c' lives after the minor collection, promoting it if it is young
+ */
+static cell minor_forward(cell c) {
+    if (!lisp_youngp(c)) return c;
+    if (c->type == MOVED) return c->adata;
+    if (c->type == FREE) return nil;    // Destroyed by the host, nothing may refer to it any more
+
+    promoted_count++;
+    return gc_move(c, &promoted);
+}
+
+static void minor_forward_children(cell c) {
+    if (c->type == CONS || c->type == NIL) c->adata = minor_forward(c->adata);
+    payload_forward(c, minor_forward);
+    c->rest = minor_forward(c->rest);
+}
+
+/*
+ * Empty the nursery, promoting the cells that are still reachable. With a static heap nothing is done
+ * if the pages could not take every young cell, allocation then carries on in the pages. Inside a region
+ * the nursery is not allocated from, collecting it is left until the region has ended.
+ */
+lisp_gc_stats lisp_gc_minor() {
+    lisp_gc_stats stats = {0, 0};
+    size_t young = nursery_top - nursery_freed;
+    if (region_active || heap_headroom() < young) return stats;
+    if (bindings_movable) bindings_release();
+
+    promoted = NULL;
+    promoted_count = 0;
+    the_empty_environment = minor_forward(the_empty_environment);
+    global_env = minor_forward(global_env);
+    for (size_t i = 0; i < gc_root_count; ++i) {
+        *gc_roots[i] = minor_forward(*gc_roots[i]);
+    }
+    for (size_t i = 0; i < mark_top; ++i) {
+        mark_stack[i] = minor_forward(mark_stack[i]);
+    }
+
+    if (remembered_overflow) {
+        for (lisp_page *page = heap_pages; page != NULL; page = page->next) {
+            for (size_t i = 0; i < page_used(page); ++i) {
+                cell c = &page->cells[i];
+                c->remembered = false;
+                if (c->type != FREE) minor_forward_children(c);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < remembered_count; ++i) {
+            cell c = remembered[i];
+            c->remembered = false;
+            // Young cells are only remembered for pointing into a region, they are forwarded themselves
+            if (c->type != FREE && !lisp_youngp(c)) minor_forward_children(c);
+        }
+    }
+
+    while (promoted != NULL) {
+        cell moved = promoted;
+        promoted = moved->rest;
+        minor_forward_children(moved->adata);
+    }
+
+    stats.objects = young - promoted_count;
+    stats.bytes = stats.objects * sizeof(lisp_cell) + nursery_free_frames();
+    nursery_top = nursery_freed = 0;
+    remembered_count = 0;
+    remembered_overflow = false;
+    return stats;
+}
+
+/*
+ * Run a complete collection, emptying the nursery and finishing any cycle already in progress first
+ */
+lisp_gc_stats lisp_sweep() {
+    lisp_gc_stats stats = lisp_gc_minor();
+    if (gc_phase != GC_IDLE) {
+        while (!lisp_gc_step(SIZE_MAX));
+        stats.objects += gc_last_cycle.objects;
+        stats.bytes += gc_last_cycle.bytes;
+    }
+    while (!lisp_gc_step(SIZE_MAX));
+    stats.objects += gc_last_cycle.objects;
+    stats.bytes += gc_last_cycle.bytes;
+    return stats;
+}
+
+static cell compacted = NULL;    // Forwarding cells whose copy still needs its car forwarded, linked by `rest'
+
+/*
+ * Returns where `c' lives after compaction. An object that has not been copied yet is copied together
+ * with the rest of its list, so that the spine of a list ends up in consecutive cells.
+ */
+static cell compact_forward(cell c) {
+    if (immediatep(c) || c == &oom_cell) return c;
+    if (c->type == MOVED) return c->adata;
+
+    cell head = NULL, last = NULL;
+    while (!immediatep(c) && c != &oom_cell && c->type != MOVED) {
+        cell copy = cell_alloc();
+        *copy = *c;
+        copy->marked = gc_black;
+        copy->remembered = false;
+        c->type = MOVED;
+        c->adata = copy;
+        c->rest = compacted;
+        compacted = c;
+
+        if (last == NULL)
+            head = copy;
+        else
+            last->rest = copy;
+        last = copy;
+        c = copy->rest;
+    }
+    last->rest = immediatep(c) || c == &oom_cell ? c : c->adata;
+    return head;
+}
+
+/*
+ * Defragment the heap. A full collection is run, then every live object is copied into fresh pages,
+ * lists in cdr order, the roots and specials are updated and the old pages are given back. C variables
+ * that are not registered with lisp_gc_root are left pointing at released memory.
+ * Returns false, having only collected, if the nursery could not be emptied or, with a static heap, if
+ * there are not enough spare pages to copy into. Nothing is done inside a region.
+ */
+bool lisp_compact() {
+    if (region_active) return false;
+    lisp_sweep();
+    if (nursery_top > 0) return false;
+
+    if ((lisp_object_count() + LISP_PAGE_CELLS - 1) / LISP_PAGE_CELLS > spare_pages()) return false;
+    bindings_release();
+
+    lisp_page *from = heap_pages;
+    size_t from_top = page_top;     // Cells used in the newest page
+    heap_pages = NULL;
+    page_top = LISP_PAGE_CELLS;
+    free_cells = NULL;
+    free_count = 0;
+    page_count = 0;
+
+    compacted = NULL;
+    for (size_t i = 0; i < N_ELEMENTS(specials); ++i) {
+        *specials[i] = compact_forward(*specials[i]);
+    }
+    for (size_t i = 0; i < gc_root_count; ++i) {
+        *gc_roots[i] = compact_forward(*gc_roots[i]);
+    }
+    while (compacted != NULL) {
+        cell moved = compacted;
+        compacted = moved->rest;
+        cell copy = moved->adata;
+        if (copy->type == CONS || copy->type == NIL) copy->adata = compact_forward(copy->adata);
+        payload_forward(copy, compact_forward);
+    }
+    intern_forward();
+
+    // Whatever was not copied is unreachable, payloads that moved belong to the copies now
+    while (from != NULL) {
+        lisp_page *next = from->next;
+        for (size_t i = 0; i < from_top; ++i) {
+            cell c = &from->cells[i];
+            if (payload_typep(c->type) && c->data != nil) mem_free(c->data);
+            if (c->type == FRAME) frame_free(frame_vector(c));
+            if (c->type == NODE) node_free(c->data);
+            if (c->type == CODE) mem_free(c->data);
+        }
+        page_free(from);
+        from = next;
+        from_top = LISP_PAGE_CELLS;
+    }
+    return true;
+}
+
+/**
+ * ----------------------------------------------------------------------
+ * Regions
+ * ----------------------------------------------------------------------
+ * A region brackets the handling of one message: everything allocated between lisp_region_begin and
+ * lisp_region_end comes from the arena (see the allocator) and is garbage afterwards, except for the
+ * value the host keeps and whatever was stored into older objects meanwhile, typically global_env
+ * through define_variableb and set_variable_valueb. The write barrier remembers those older objects,
+ * so lisp_region_end evacuates from `keep', the host's roots and the remembered set only, copying the
+ * reachable arena cells into the pages much as a minor collection does, then resets the arena in one go.
+ * The cost is proportional to what is kept, not to what the message allocated.
+ */
+static cell evacuated = NULL;   // Forwarding cells whose copy is still to be scanned, linked by `rest'
+
+static cell region_forward(cell c) {
+    if (!lisp_arenap(c)) return c;
+    if (c->type == MOVED) return c->adata;
+    if (c->type == FREE) return nil;
+
+    any payload = NULL;
+    if (payload_typep(c->type) && c->data != nil) {
+        size_t len = strlen(c->string) + 1;
+        if ((payload = mem_alloc(len)) == NULL) return &oom_cell;
+        memcpy(payload, c->data, len);
+    } else if (c->type == FRAME && lisp_arenap(c->data)) {
+        // An arena vector is copied into the pages. One that grew out of the arena is already there and
+        // goes with the copy as it is
+        lisp_frame *vector = frame_vector(c);
+        if ((payload = frame_alloc(vector->size)) == NULL) return &oom_cell;
+        memcpy(payload, vector, frame_bytes(vector->count));
+    }
+    cell copy = gc_move(c, &evacuated);
+    if (copy == &oom_cell)
+        mem_free(payload);
+    else if (payload != NULL)
+        copy->data = payload;
+    return copy;
+}
+
+/*
+ * Does `c' point into the nursery
+ */
+static bool region_youngp(cell c) {
+    if ((c->type == CONS || c->type == NIL) && lisp_youngp(c->adata)) return true;
+    if (c->type == FRAME) {
+        lisp_frame *vector = frame_vector(c);
+        if (lisp_youngp(vector->names)) return true;
+        for (size_t i = 0; i < vector->count; ++i) {
+            if (lisp_youngp(vector->slots[i])) return true;
+        }
+    }
+    return lisp_youngp(c->rest);
+}
+
+static void region_forward_children(cell c) {
+    if (c->type == CONS || c->type == NIL) c->adata = region_forward(c->adata);
+    payload_forward(c, region_forward);
+    c->rest = region_forward(c->rest);
+}
+
+/*
+ * Route every allocation into the arena until lisp_region_end, regions do not nest
+ */
+bool lisp_region_begin() {
+    if (region_active) return false;
+    if (lisp_arena == NULL) {
+        lisp_arena = mem_alloc(LISP_REGION_BYTES);
+        if (lisp_arena == NULL) return false;
+    }
+    arena_top = 0;
+    lisp_arena_end = lisp_arena + LISP_REGION_BYTES;
+    region_active = true;
+    return true;
+}
+
+/*
+ * Evacuate `keep' and whatever the region stored into older objects, then drop the arena. Returns the
+ * new location of `keep'. C variables still pointing into the arena, other than the roots, are stale.
+ */
+cell lisp_region_end(cell keep) {
+    if (!region_active) return keep;
+    if (bindings_movable) bindings_release();
+
+    evacuated = NULL;
+    keep = region_forward(keep);
+    for (size_t i = 0; i < gc_root_count; ++i) {
+        *gc_roots[i] = region_forward(*gc_roots[i]);
+    }
+
+    if (remembered_overflow) {
+        for (lisp_page *page = heap_pages; page != NULL; page = page->next) {
+            for (size_t i = 0; i < page_used(page); ++i) {
+                cell c = &page->cells[i];
+                if (c->type != FREE && c->type != MOVED) region_forward_children(c);
+            }
+        }
+        for (size_t i = 0; i < nursery_top; ++i) {
+            if (lisp_nursery[i].type != FREE) region_forward_children(&lisp_nursery[i]);
+        }
+    }
+    // Arena cells leave the remembered set, their copies are added back below if need be
+    size_t count = 0;
+    for (size_t i = 0; i < remembered_count; ++i) {
+        cell c = remembered[i];
+        if (lisp_arenap(c)) continue;
+        if (c->type != FREE) region_forward_children(c);
+        remembered[count++] = c;
+    }
+    remembered_count = count;
+
+    while (evacuated != NULL) {
+        cell moved = evacuated;
+        evacuated = moved->rest;
+        cell copy = moved->adata;
+        region_forward_children(copy);
+        if (region_youngp(copy)) lisp_gc_remember(copy);
+    }
+    arena_frames_release();
+
+    // Grey arena cells that were not evacuated are garbage
+    count = 0;
+    for (size_t i = 0; i < mark_top; ++i) {
+        cell c = mark_stack[i];
+        if (lisp_arenap(c)) {
+            if (c->type != MOVED) continue;
+            c = c->adata;
+        }
+        mark_stack[count++] = c;
+    }
+    mark_top = count;
+
+    region_active = false;
+    arena_reset();
+    return keep;
+}
+
+/**
+ * Quotas
+ * A quota is a region with a limit. Every cell allocated between lisp_quota_begin and lisp_quota_end is
+ * charged against it, with the bytes of the cell and its payload, as are the reader's buffers. The
+ * first allocation past either limit fails, and so does every one after it, so evaluation unwinds with
+ * the out of memory ERROR however it got there. Running out of arena counts as exceeding the quota too:
+ * what the evaluation made is then all in the arena, and dropped at once by the end of the region. The
+ * byte limit is therefore clamped to LISP_REGION_BYTES.
+ * Symbols are interned for good and come from the pages, they are charged but outlive the quota. So do
+ * NODE and CODE cells, with their trees and bytecode from mem_alloc: charged, but left to the collector.
+ * A quota is not a transaction either. What the message stored into older objects before it failed, a
+ * define or set! of a global say, stays, and lisp_region_end evacuates the arena cells it refers to.
+ */
+static bool quota_active = false;
+static bool quota_exceeded = false;
+static lisp_quota_usage quota_limit, quota_used;
+
+/*
+ * Charge an allocation to the quota, returns false if it does not fit
+ */
+static bool quota_charge(size_t cells, size_t bytes) {
+    if (!quota_active) return true;
+    if (!quota_exceeded) {
+        quota_used.cells += cells;
+        quota_used.bytes += bytes;
+        quota_exceeded = quota_used.cells > quota_limit.cells || quota_used.bytes > quota_limit.bytes;
+    }
+    return !quota_exceeded;
+}
+
+bool lisp_quota_begin(size_t cells, size_t bytes) {
+    if (!lisp_region_begin()) return false;
+    quota_active = true;
+    quota_exceeded = false;
+    quota_limit.cells = cells;
+    quota_limit.bytes = bytes < LISP_REGION_BYTES ? bytes : LISP_REGION_BYTES;
+    quota_used.cells = quota_used.bytes = 0;
+    return true;
+}
+
+/*
+ * End the region of the quota, keeping `keep' unless the quota was exceeded, when the result is an ERROR
+ */
+cell lisp_quota_end(cell keep) {
+    if (!quota_active) return keep;
+    quota_active = false;
+    keep = lisp_region_end(quota_exceeded ? nil : keep);
+    return quota_exceeded ? mkerror(ERR_QUOTA) : keep;
+}
+
+lisp_quota_usage lisp_quota_used() {
+    return quota_used;
+}
+
+static void gc_reset() {
+    gc_phase = GC_IDLE;
+    lisp_gc_marking = false;
+    mark_top = 0;
+    mark_overflow = false;
+    gc_rescanning = false;
+    gc_page = NULL;
+    remembered_count = 0;
+    remembered_overflow = false;
+}
+
+bool lisp_free(bool force_clean_all) {
+    if (!force_clean_all) {
+        lisp_sweep();
+    } else {
+        gc_reset();
+        bindings_release();
+#ifdef DEBUG
+        puts("Delete all objects");
+        printf("Objects before %d\n", (int) lisp_object_count());
+#endif
+        for (lisp_page *page = heap_pages; page != NULL; page = page->next) {
+            for (size_t i = 0; i < page_used(page); ++i) {
+                cell c = &page->cells[i];
+                if (c->type != FREE) lisp_destroy(c);
+            }
+        }
+        nursery_free_frames();
+        nursery_top = nursery_freed = 0;
+        arena_frames_release();
+        region_active = quota_active = false;
+        arena_reset();
+#ifdef DEBUG
+        printf("Objects after %d\n", (int) lisp_object_count());
+#endif
+    }
+
+    return true;
+}
+
+/*
+ * Returns `address' if it is a live object in the heap, otherwise nil
+ */
+cell find_object(cell address) {
+    if (address >= lisp_nursery && address < lisp_nursery + nursery_top)
+        return address->type == FREE ? nil : address;
+    for (lisp_page *page = heap_pages; page != NULL; page = page->next) {
+        if (page_containsp(page, address))
+            return address->type == FREE ? nil : address;
+    }
+    return nil;
+}
+
+/**
+ * ----------------------------------------------------------------------
+ * Evaluation
+ *
+ * See: https://mitpress.mit.edu/sicp/full-text/book/book-Z-H-26.html
+ *
+ */
+
+/*
+ * The deepest and shallowest C stack addresses eval has been entered at since lisp_stack_reset
+ */
+static uintptr_t stack_low = UINTPTR_MAX;
+static uintptr_t stack_high = 0;
+
+#define stack_note(P)   do { uintptr_t _at = (uintptr_t) (P);                      \
+                             if (_at < stack_low) stack_low = _at;                  \
+                             if (_at > stack_high) stack_high = _at; } while (0)
+
+size_t lisp_stack_high_water() {
+    return stack_high > stack_low ? stack_high - stack_low : 0;
+}
+
+void lisp_stack_reset() {
+    char here;
+    stack_low = stack_high = (uintptr_t) &here;
+}
+
+/*
+ * Evaluates all but the last of `exps' and returns the last, for the caller to evaluate in its place
+ */
+static cell sequence_last(cell exps, cell env) {
+    for (; !nullp(exps) && !last_expp(exps); exps = rest_exps(exps)) {
+        cell result = eval(first_exp(exps), env);
+        if (errorp(result)) return result;
+    }
+    return nullp(exps) ? nil : first_exp(exps);
+}
+
+/*
+ * Special forms are told apart by the form their operator symbol carries, one switch rather than a test
+ * for each form before an application is recognised. An expression in tail position, the branches of
+ * an if, the last of a sequence or a compound procedure body, replaces `exp' and goes round the loop
+ * again rather than calling eval, so a tail recursive loop runs in constant C stack
+ */
+cell eval(cell exp, cell env) {
+    stack_note(&exp);
+    for (;;) {
+        if (errorp(exp))            return exp;
+        if (self_evaluatingp(exp))  return exp;
+        if (variablep(exp))         return lookup_variable_value(exp, env);
+        if (lexicalp(exp))          return lexical_value(exp, env);
+        if (pairp(exp)) {
+            switch (special_form(operator(exp))) {
+                case FORM_QUOTE:    return cadr(exp);
+                case FORM_SETB:     return eval_assignment(exp, env);
+                case FORM_DEFINE:   return eval_definition(exp, env);
+                case FORM_DEFINE_MACRO: return eval_macro_definition(exp, env);
+                case FORM_IF: {
+                    cell predicate = eval(if_predicate(exp), env);
+                    if (errorp(predicate)) return predicate;
+                    exp = truep(predicate) ? if_consequent(exp) : if_alternate(exp);
+                    continue;
+                }
+                case FORM_LAMBDA:
+                    return mkprocedure(lambda_parameters(exp),
+                                       lambda_body(lexical_address(exp)), env);
+                case FORM_BEGIN:    exp = sequence_last(begin_actions(exp), env); continue;
+                case FORM_COND:     exp = lisp_splice(exp, cond_if(exp)); continue;
+                case FORM_NONE:     break;
+            }
+        }
+        if (!applicationp(exp))
+            return mkerror("Unknown expression type -- EVAL");
+
+        cell proc = eval(operator(exp), env);
+        if (errorp(proc)) return proc;
+        if (macrop(proc)) {
+            exp = lisp_macroexpand(proc, exp);
+            continue;
+        }
+        cell arguments = list_of_values(operands(exp), env);
+        if (!compound_procp(proc) || errorp(arguments) || !pairp(procedure_body(proc)))
+            return apply(proc, arguments);
+
+        env = extend_environment(procedure_parameters(proc), arguments, procedure_environment(proc));
+        if (errorp(env)) return env;
+        exp = sequence_last(procedure_body(proc), env);
+    }
+}
+
+cell list_of_values(cell exps, cell env) {
+    if (no_operandsp(exps))
+        return nil;
+
+    cell value = eval(first_operand(exps), env);
+    if (errorp(value)) return value;
+    cell values = list_of_values(rest_operands(exps), env);
+    if (errorp(values)) return values;
+    return cons(value, values);
+}
+
+bool falsep(cell exp) {
+    return exp == lisp_false || nullp(exp);
+}
+
+bool truep(cell exp) {
+    return !falsep(exp);
+}
+
+cell eval_if(cell exp, cell env) {
+    cell predicate = eval(if_predicate(exp), env);
+    if (errorp(predicate))
+        return predicate;
+    else if (truep(predicate))
+        return eval(if_consequent(exp), env);
+    else
+        return eval(if_alternate(exp), env);
+}
+
+cell eval_sequence(cell exps, cell env) {
+    return eval(sequence_last(exps, env), env);
+}
+
+cell eval_assignment(cell exp, cell env) {
+    cell value = eval(assignment_value(exp), env);
+    if (errorp(value)) return value;
+    cell result = set_variable_valueb(assignment_variable(exp), value, env);
+    if (errorp(result))
+        return result;
+    else
+        return lisp_true;
+}
+
+cell eval_definition(cell exp, cell env) {
+    cell value = eval(definition_value(exp), env);
+    if (errorp(value)) return value;
+    cell result = define_variableb(definition_variable(exp), value, env);
+    if (errorp(result)) return result;
+    return lisp_true;
+}
+
+cell mkprocedure(cell parameters, cell body, cell env) {
+    return mklist(4, procedure, parameters, body, env);
+}
+
+/*
+ * Store `val' in a slot of the FRAME `frame'
+ */
+#define frame_store(F, I, V)    (frame_slot(F, I) = lisp_write_barrier(F, V))
+
+/*
+ * A FRAME of `size' slots, none in use yet, in front of `base_env'
+ */
+static cell frame_make(cell names, size_t size, cell base_env) {
+    cell frame = lisp_alloc(FRAME, frame_bytes(size), NULL, base_env);
+    if (errorp(frame)) return frame;
+    lisp_frame *vector;
+    if (lisp_arenap(frame)) {
+        // An arena cell is followed by room for its payload
+        vector = (lisp_frame *) (frame + 1);
+        vector->size = size;
+        vector->count = 0;
+    } else if ((vector = frame_alloc(size)) == NULL) {
+        cell_release(frame);
+        return &oom_cell;
+    }
+    frame->data = vector;
+    vector->names = lisp_write_barrier(frame, names);
+    return frame;
+}
+
+/*
+ * The slot of `frame' holding `var', or -1
+ */
+static long frame_find(cell frame, cell var) {
+    long slot = 0;
+    for (cell names = frame_vector(frame)->names; pairp(names); names = cdr(names), ++slot) {
+        if (car(names) == var) return slot;
+    }
+    return -1;
+}
+
+/*
+ * Add a slot for `var' at the end of `frame', moving its values to a larger vector if they fill this one.
+ * The names are the procedure's parameter list, shared with every other call, so the frame is given a
+ * list of its own with `var' on the end. Running out of memory leaves the frame as it was.
+ */
+static cell frame_add(cell frame, cell var, cell val) {
+    lisp_frame *vector = frame_vector(frame);
+    cell names = nil, last = nil;
+    for (cell c = vector->names; ; c = cdr(c)) {
+        cell link = cons(pairp(c) ? car(c) : var, nil);
+        if (errorp(link)) return link;
+        if (nullp(names))
+            names = link;
+        else
+            setcdrb(last, link);
+        last = link;
+        if (!pairp(c)) break;
+    }
+    if (vector->count == vector->size) {
+        lisp_frame *grown = frame_alloc(vector->size * 2 + 1);
+        if (grown == NULL) return &oom_cell;
+        if (lisp_arenap(frame) && lisp_arenap(frame->data) && !arena_frame_add(frame)) {
+            frame_free(grown);
+            return &oom_cell;
+        }
+        memcpy(grown->slots, vector->slots, sizeof(cell) * vector->count);
+        grown->count = vector->count;
+        if (!lisp_arenap(frame->data)) frame_free(vector);
+        frame->data = vector = grown;
+    }
+    vector->names = lisp_write_barrier(frame, names);
+    vector->count++;
+    return frame_store(frame, vector->count - 1, val);
+}
+
+static cell frame_push(cell frame, cell var, cell val) {
+    // Both conses are made before the frame changes, running out of memory leaves it as it was
+    cell vars = cons(var, car(frame));
+    if (errorp(vars)) return vars;
+    cell vals = cons(val, cdr(frame));
+    if (errorp(vals)) return vals;
+    setcarb(frame, vars);
+    return setcdrb(frame, vals);
+}
+
+/*
+ * The new binding may shadow one in the frame, an index over it is dropped
+ */
+cell add_binding_to_frameb(cell var, cell val, cell frame) {
+    if (framep(frame)) return frame_add(frame, var, val);
+    if (bindings_env != NULL && frame == first_frame(bindings_env)) bindings_release();
+    return frame_push(frame, var, val);
+}
+
+cell sum(cell parms) {
+    cell c = parms;
+    lisp_fixnum result = 0;
+    while(!nullp(c)) {
+        result += fixnum(car(c));
+        c = rest(c);
+    }
+    return mkfixnum(result);
+}
+
+cell product(cell parms) {
+    cell c = parms;
+    lisp_fixnum result = 1;
+    while(!nullp(c)) {
+        result *= fixnum(car(c));
+        c = rest(c);
+    }
+    return mkfixnum(result);
+}
+
+cell subtract(cell parms) {
+    cell c = parms;
+    lisp_fixnum result = fixnum(car(parms));
+    c = rest(c);
+    while(!nullp(c)) {
+        result -= fixnum(car(c));
+        c = rest(c);
+    }
+    return mkfixnum(result);
+}
+
+cell divide(cell parms) {
+    cell c = parms;
+    lisp_fixnum result = fixnum(car(parms));
+    c = rest(c);
+    while(!nullp(c)) {
+        result /= fixnum(car(c));
+        c = rest(c);
+    }
+    return mkfixnum(result);
+}
+
+cell equals(cell parms) {
+    cell lhs = first(parms);
+    cell rhs = second(parms);
+    if (lhs == rhs) return lisp_true;
+    switch (lisp_typeof(lhs)) {
+        case NIL:
+            if (lisp_typeof(rhs) == NIL) return lisp_true;
+            break;
+        case FIXNUM:
+            if (lisp_typeof(rhs) == FIXNUM && fixnum(lhs) == fixnum(rhs)) return lisp_true;
+            break;
+        case CHAR:
+            if (lisp_typeof(rhs) == CHAR && character(lhs) == character(rhs)) return lisp_true;
+            break;
+#ifdef WITH_FLOATING_POINT
+        case FLOAT:break;
+#endif
+        case STRING:
+        case SYM:
+        case ERROR:
+            if (lisp_equals(lhs, rhs)) return lisp_true;
+        case CONS:break;
+        case FN:break;
+        case LEXICAL:break;
+        case FRAME:break;
+        case NODE:break;
+        case CODE:break;
+        case FREE:break;
+        case MOVED:break;
+    }
+    return nil;
+}
+
+cell printer(cell params) {
+    cell c = params;
+    while(!nullp(c)) {
+        cell val = car(c);
+        switch (lisp_typeof(val)) {
+            case NIL: printf("NIL"); break;
+            case FIXNUM: printf("%li", fixnum(val)); break;
+            case CHAR: printf("%c", character(val)); break;
+#ifdef WITH_FLOATING_POINT
+            case FLOAT: printf("%f", floater(val)); break;
+#endif
+            case SYM:
+                printf("<#SYM: %s>", symbol(val));
+                break;
+            case LEXICAL:
+                printf("<#SYM: %s>", symbol(lexical_name(val)));
+                break;
+            case STRING:
+            case ERROR:
+                printf(val->string);
+                break;
+            case FN:
+            case CONS:
+            case FRAME:
+            case NODE:
+            case CODE:
+            case FREE:
+            case MOVED:
+                printf("<?>");
+                break;
+        }
+        c = rest(c);
+    }
+    return nil;
+}
+
+cell construct(cell parms) {
+    return cons(first(parms), second(parms));
+}
+
+cell first_of(cell parms) {
+    cell pair = first(parms);
+    return pairp(pair) || nullp(pair) ? car(pair) : mkerror("Not a pair -- CAR");
+}
+
+cell rest_of(cell parms) {
+    cell pair = first(parms);
+    return pairp(pair) || nullp(pair) ? cdr(pair) : mkerror("Not a pair -- CDR");
+}
+
+cell list_of(cell parms) {
+    return parms;   // The arguments were consed for the call
+}
+
+cell primitive_procedure_names() {
+    cell c[] = {
+            mksym("+"),
+            mksym("-"),
+            mksym("*"),
+            mksym("/"),
+            mksym("="),
+            mksym("print"),
+            mksym("compile"),
+            mksym("cons"),
+            mksym("car"),
+            mksym("cdr"),
+            mksym("list")
+    };
+
+    return mklist_from_array(N_ELEMENTS(c), c);
+}
+
+cell primitive_procedure_objects() {
+    cell c[] = {
+            mkfn("+", &sum),
+            mkfn("-", &subtract),
+            mkfn("*", &product),
+            mkfn("/", &divide),
+            mkfn("=", &equals),
+            mkfn("print", &printer),
+            mkfn("compile", &compile),
+            mkfn("cons", &construct),
+            mkfn("car", &first_of),
+            mkfn("cdr", &rest_of),
+            mkfn("list", &list_of)
+    };
+
+    return mklist_from_array(N_ELEMENTS(c), c);
+}
+
+cell setup_environment() {
+    // A list frame, global definitions go through the index of Global bindings
+    cell frame = mkframe(primitive_procedure_names(), primitive_procedure_objects());
+    cell initial = errorp(frame) ? frame : cons(frame, the_empty_environment);
+    define_variableb(mksym("true"), mkfixnum(1), initial);
+    define_variableb(mksym("false"), nil, initial);
+    return initial;
+}
+
+/*
+ * A FRAME binding `vars' to `vals' in front of `base_env'. The arity is checked while counting the
+ * values, in a single walk of both lists, and `vars' is shared by the frame rather than copied.
+ */
+cell extend_environment(cell vars, cell vals, cell base_env) {
+    size_t count = 0;
+    cell var = vars, val = vals;
+    for (; pairp(var) && pairp(val); var = cdr(var), val = cdr(val)) count++;
+    if (pairp(val))
+        return mkerror("Too many arguments supplied -- EXTEND_ENVIRONMENT");
+    else if (pairp(var))
+        return mkerror("Too few arguments supplied -- EXTEND_ENVIRONMENT");
+
+    cell frame = frame_make(vars, count, base_env);
+    if (errorp(frame)) return frame;
+    lisp_frame *vector = frame_vector(frame);
+    for (; vector->count < count; vals = cdr(vals)) {
+        vector->slots[vector->count++] = lisp_write_barrier(frame, car(vals));
+    }
+    return frame;
+}
+
+
+cell env_loop(cell env, cell var);
+cell env_loop2(cell env, cell var, cell val);
+cell scan_aux(cell vars, cell vals, cell var, cell env) {
+    if (nullp(vars))
+        return env_loop(enclosing_environment(env), var);
+    else if (lisp_equals(var, car(vars)))
+        return car(vals);
+    else
+        return scan_aux(cdr(vars), cdr(vals), var, env);
+}
+
+cell scan_aux2(cell vars, cell vals, cell var, cell val, cell env) {
+    if (nullp(vars))
+        return env_loop(enclosing_environment(env), var);
+    else if (lisp_equals(var, car(vars)))
+        return setcarb(vals, val);
+    else
+        return scan_aux2(cdr(vars), cdr(vals), var, val, env);
+}
+
+cell env_loop(cell env, cell var) {
+    if (env == the_empty_environment)
+        return mkerror("Unbound Variable -- lookup_variable_value");
+    else if (framep(env)) {
+        long slot = frame_find(env, var);
+        return slot >= 0 ? frame_slot(env, slot) : env_loop(enclosing_environment(env), var);
+    } else if (bindings_indexp(env)) {
+        binding_entry *entry = bindings_find(var);
+        return entry != NULL ? car(entry->vals) : env_loop(enclosing_environment(env), var);
+    } else {
+        cell frame = first_frame(env);
+        return scan_aux(frame_variables(frame), frame_values(frame), var, env);
+    }
+}
+
+cell env_loop2(cell env, cell var, cell val) {
+    if (env == the_empty_environment)
+        return mkerror("Unbound Variable -- set_variable_valueb");
+    else if (framep(env)) {
+        long slot = frame_find(env, var);
+        return slot >= 0 ? frame_store(env, slot, val) : env_loop2(enclosing_environment(env), var, val);
+    } else if (bindings_indexp(env)) {
+        binding_entry *entry = bindings_find(var);
+        return entry != NULL ? bindings_set(entry, val) : env_loop2(enclosing_environment(env), var, val);
+    } else {
+        cell frame = first_frame(env);
+        return scan_aux2(frame_variables(frame), frame_values(frame), var, val, env);
+    }
+}
+
+cell lookup_variable_value(cell var, cell env) {
+    return env_loop(env, var);
+}
+
+cell set_variable_valueb(cell var, cell val, cell env) {
+    if (lexicalp(var)) return lexical_assign(var, val, env);
+    return env_loop2(env, var, val);
+}
+
+cell def_variable_aux(cell vars,cell vals, cell var, cell val, cell frame) {
+    bool should_define = nullp(vars);
+    bool found = lisp_equals(var, car(vars));
+    if (should_define)
+        return add_binding_to_frameb(var, val, frame);
+    else if (found)
+        return setcarb(vals, val);
+    else
+        return def_variable_aux(cdr(vars), cdr(vals), var, val, frame);
+}
+
+cell define_variableb(cell var, cell val, cell env) {
+    cell frame = first_frame(env);
+    if (framep(frame)) {
+        long slot = frame_find(frame, var);
+        return slot >= 0 ? frame_store(frame, slot, val) : frame_add(frame, var, val);
+    } else if (bindings_indexp(env)) {
+        binding_entry *entry = bindings_find(var);
+        if (entry != NULL) return bindings_set(entry, val);
+        cell result = frame_push(frame, var, val);
+        if (!errorp(result)) bindings_add(var, frame_values(frame));
+        return result;
+    }
+    return def_variable_aux(frame_variables(frame), frame_values(frame), var, val, frame);
+}
+
+cell apply(cell proc, cell arguments) {
+    if (errorp(proc)) return proc;
+    if (errorp(arguments)) return arguments;
+    if (primitive_procp(proc)) {
+        return primitive_call(proc, arguments);
+    } else if (compound_procp(proc)) {
+        cell env = extend_environment(procedure_parameters(proc),
+                                      arguments, procedure_environment(proc));
+        if (errorp(env)) return env;
+        cell body = procedure_body(proc);
+        if (codep(body)) return lisp_run(body, env);
+        return nodep(body) ? lisp_execute(body, env) : eval_sequence(body, env);
+    } else if (codep(proc)) {
+        // Compiled top level code takes no arguments
+        return nullp(arguments) ? lisp_run(proc, global_env) : mkerror("Too many arguments supplied -- APPLY");
+    }
+    return mkerror("Unknown procedure type - APPLY");
+}
+
+bool self_evaluatingp(cell exp) {
+    enum lisp_type type = lisp_typeof(exp);
+    return (type == STRING || type == CHAR || numberp(exp) || nullp(exp));
+}
+
+bool variablep(cell exp) {
+    return symbolp(exp);
+}
+
+cell definition_variable(cell exp) {
+    if(symbolp(cadr(exp)))
+        return (cadr(exp));
+    else
+        return (caadr(exp));
+}
+
+cell definition_value(cell exp) {
+    if(symbolp(cadr(exp)))
+        return (caddr(exp));
+    else
+        return mklambda(cdadr(exp), cddr(exp));
+}
+
+cell if_alternate(cell exp) {
+    if (!nullp(cdddr(exp)))
+        return cadddr(exp);
+    return nil;
+}
+
+cell mkif(cell predicate, cell consequent, cell altnerate) {
+    return cons(lisp_if, cons(predicate, cons(consequent, cons(altnerate, nil))));
+}
+
+
+cell mkbegin(cell seq) {
+    return cons(lisp_begin, seq);
+}
+
+cell sequence_exp(cell seq) {
+    if (nullp(seq))
+        return seq;
+    else if (last_expp(seq))
+        return first_exp(seq);
+    else
+        return mkbegin(seq);
+}
+
+cell expand_clauses(cell clauses) {
+    if (nullp(clauses)) {
+        return nil;
+    }
+    cell first = car(clauses);
+    cell rest = cdr(clauses);
+
+    if (cond_elsep(first)) {
+       if (nullp(rest)) {
+           return sequence_exp(cond_actions(first));
+       } else {
+           return mkerror("ELSE clause isn't last cond-if");
+       }
+    } else {
+        return mkif(cond_predicate(first),
+                sequence_exp(cond_actions(first)),
+                expand_clauses(rest));
+    }
+}
+
+
+/**
+ * ----------------------------------------------------------------------
+ * Macros
+ *
+ * A macro is a procedure from the operands of a call, as read, to the expression to evaluate instead.
+ * The call is expanded the first time it is reached and the expansion spliced over it: the call's pair
+ * takes the car and cdr of the expansion, so every later evaluation of that source finds the expansion
+ * itself and the macro never runs again for it. cond is expanded the same way, into its nested ifs.
+ *
+ * Lexical addressing, analysis and compilation expand the calls of macros bound in global_env as they
+ * come to them, before an operand is taken for an expression, so a macro should be defined before the
+ * procedures that use it. An expansion becomes part of the source and may be addressed in place: it
+ * should be made afresh, with list and cons, rather than be quoted data of the macro.
+ */
+cell eval_macro_definition(cell exp, cell env) {
+    cell transformer = eval(definition_value(exp), env);
+    if (errorp(transformer)) return transformer;
+    if (!compound_procp(transformer) && !primitive_procp(transformer))
+        return mkerror("Not a procedure -- DEFINE-MACRO");
+    cell macro = cons(lisp_macro, transformer);
+    if (errorp(macro)) return macro;
+    cell result = define_variableb(definition_variable(exp), macro, env);
+    return errorp(result) ? result : lisp_true;
+}
+
+/*
+ * Put `expansion' in the place of the expression `exp', which is returned. Anything but a pair is spliced
+ * in as (begin expansion).
+ */
+cell lisp_splice(cell exp, cell expansion) {
+    if (errorp(expansion)) return expansion;
+    if (!pairp(expansion)) expansion = mkbegin(cons(expansion, nil));
+    if (errorp(expansion)) return expansion;
+    setcarb(exp, car(expansion));
+    setcdrb(exp, cdr(expansion));
+    exp->addressed = expansion->addressed;
+    return exp;
+}
+
+/*
+ * Expand the call `exp' of `macro' in place
+ */
+cell lisp_macroexpand(cell macro, cell exp) {
+    return lisp_splice(exp, apply(macro_procedure(macro), operands(exp)));
+}
+
+/*
+ * The macro the operator `op' names in global_env, or nil
+ */
+static cell macro_named(cell op) {
+    if (lexicalp(op) && lexical_freep(op)) op = lexical_name(op);
+    if (!symbolp(op) || !bindings_indexp(global_env)) return nil;
+    binding_entry *entry = bindings_find(op);
+    return entry != NULL && macrop(car(entry->vals)) ? car(entry->vals) : nil;
+}
+
+/**
+ * ----------------------------------------------------------------------
+ * Lexical addressing
+ *
+ * See: https://mitpress.mit.edu/sicp/full-text/book/book-Z-H-35.html#%_sec_5.5.6
+ *
+ * The first time a lambda expression is evaluated its body is rewritten in place: every reference to a
+ * variable bound by it or by an enclosing lambda becomes a LEXICAL cell holding the number of frames to
+ * go out and the position in that frame, so evaluating it walks straight to the value without comparing
+ * a single name. A name no enclosing lambda binds is addressed as free: after going out of all of them it
+ * is looked up by name, normally in global_env. Quoted data is left alone and nested lambdas are
+ * addressed along with the lambda that contains them.
+ *
+ * An internal define adds to its frame at run time, after the parameters, so what else the frame holds
+ * is not known beforehand. Nothing is addressed through a lambda whose body defines, its references stay
+ * symbols and are looked up as before.
+ *
+ * Inline caches
+ * A free variable is mostly a global, or a primitive, referred to again on every call. Its LEXICAL cell
+ * carries a cache, `rest' is (symbol . value), stamped with the version of the globals it was filled at:
+ * while the stamp is current and the environment it is looked up in is global_env the cached value is
+ * the answer. Only bindings found through the index of Global bindings are cached, and those bump the
+ * version when they change, see bindings_set. global_env itself being replaced empties the caches too.
+ */
+static lisp_cache_stats cache_stats = {0, 0};
+static cell cache_env = NULL;   // global_env when the caches were filled
+typedef struct scope {
+    cell params;                // Parameters of the lambda, in frame order
+    bool defines;               // The body may add to the frame
+    struct scope *outer;
+} scope;
+
+static cell address_exp(cell exp, scope *s);
+
+cell mklexical(int depth, int slot, cell var) {
+    lisp_cell address;
+    address.address.depth = depth;
+    address.address.slot = slot;
+    address.address.stamp = 0;
+    if (slot == LEXICAL_FREE) {
+        var = cons(var, nil);
+        if (errorp(var)) return var;
+    }
+    return lisp_alloc(LEXICAL, sizeof(address.address), &address.address, var);
+}
+
+/*
+ * Does evaluating `exp' define into the current frame
+ */
+static bool definesp(cell exp) {
+    if (!pairp(exp)) return false;
+    switch (special_form(car(exp))) {
+        case FORM_DEFINE:
+        case FORM_DEFINE_MACRO: return true;
+        case FORM_QUOTE:
+        case FORM_LAMBDA:   return false;
+        default:
+            for (; pairp(exp); exp = cdr(exp)) {
+                if (definesp(car(exp))) return true;
+            }
+            return false;
+    }
+}
+
+/*
+ * Is `var' a parameter of one of the lambdas around
+ */
+static bool scope_bindsp(scope *s, cell var) {
+    for (; s != NULL; s = s->outer) {
+        for (cell p = s->params; pairp(p); p = cdr(p)) {
+            if (car(p) == var) return true;
+        }
+    }
+    return false;
+}
+
+static cell address_var(cell var, scope *s) {
+    if (!symbolp(var)) return var;
+    int depth = 0;
+    for (; s != NULL; s = s->outer, ++depth) {
+        if (s->defines || depth > LEXICAL_MAX) return var;
+        int slot = 0;
+        for (cell p = s->params; pairp(p) && slot <= LEXICAL_MAX; p = cdr(p), ++slot) {
+            if (car(p) == var) {
+                cell address = mklexical(depth, slot, var);
+                return errorp(address) ? var : address;
+            }
+        }
+    }
+    cell address = mklexical(depth, LEXICAL_FREE, var);
+    return errorp(address) ? var : address;
+}
+
+/*
+ * Address each element of the list `exps'
+ */
+static void address_list(cell exps, scope *s) {
+    for (; pairp(exps); exps = cdr(exps)) {
+        cell exp = car(exps), addressed = address_exp(exp, s);
+        if (addressed != exp) setcarb(exps, addressed);
+    }
+}
+
+static void address_lambda(cell exp, cell params, cell body, scope *s) {
+    scope inner = { params, false, s };
+    for (cell c = body; pairp(c) && !inner.defines; c = cdr(c)) inner.defines = definesp(car(c));
+    address_list(body, &inner);
+    exp->addressed = true;
+}
+
+static cell address_exp(cell exp, scope *s) {
+    if (symbolp(exp)) return address_var(exp, s);
+    if (!pairp(exp)) return exp;
+
+    switch (special_form(car(exp))) {
+        case FORM_QUOTE:
+            break;
+        case FORM_LAMBDA:
+            if (!exp->addressed) address_lambda(exp, lambda_parameters(exp), lambda_body(exp), s);
+            break;
+        case FORM_DEFINE:
+        case FORM_DEFINE_MACRO:
+            if (pairp(cadr(exp)))
+                address_lambda(exp, cdadr(exp), cddr(exp), s);     // (define (name params) body)
+            else
+                address_list(cddr(exp), s);
+            break;
+        case FORM_SETB:
+            address_list(cdr(exp), s);
+            break;
+        case FORM_COND:
+            for (cell clauses = cond_clauses(exp); pairp(clauses); clauses = cdr(clauses)) {
+                cell clause = car(clauses);
+                address_list(cond_elsep(clause) ? cond_actions(clause) : clause, s);
+            }
+            break;
+        case FORM_IF:
+        case FORM_BEGIN:
+            address_list(cdr(exp), s);
+            break;
+        case FORM_NONE: {
+            // A macro is expanded before its operands are addressed, they may not be expressions at all
+            cell macro = scope_bindsp(s, car(exp)) ? nil : macro_named(car(exp));
+            if (!nullp(macro) && !errorp(lisp_macroexpand(macro, exp))) return address_exp(exp, s);
+            address_list(exp, s);   // An application, the operator is addressed too
+            break;
+        }
+    }
+    return exp;
+}
+
+/*
+ * Address the body of the lambda expression `exp' unless that has been done already
+ */
+cell lexical_address(cell exp) {
+    if (lambdap(exp) && !exp->addressed) address_lambda(exp, lambda_parameters(exp), lambda_body(exp), NULL);
+    return exp;
+}
+
+/*
+ * The FRAME holding the variable at `address', every lambda is applied through extend_environment. nil
+ * if the variable is free, `env' is then the environment to look its name up in.
+ */
+static cell lexical_frame(cell address, cell *env) {
+    for (int32_t depth = lexical_depth(address); depth > 0; --depth) *env = enclosing_environment(*env);
+    return lexical_slot(address) == LEXICAL_FREE ? nil : *env;
+}
+
+/*
+ * Look a free variable up by name, caching its value if it is found in the index of global_env
+ */
+static cell lexical_lookup(cell address, cell env) {
+    cell var = lexical_name(address);
+    cache_stats.misses++;
+    if (env != global_env || !bindings_indexp(env)) return lookup_variable_value(var, env);
+
+    binding_entry *entry = bindings_find(var);
+    if (entry == NULL) return lookup_variable_value(var, env);
+    if (cache_env != global_env) {
+        globals_changed();
+        cache_env = global_env;
+    }
+    entry->cached = true;
+    address->address.stamp = globals_version;
+    return setcdrb(cdr(address), car(entry->vals));
+}
+
+// The inline cache of the free variable at `address' holds its value in `env'
+#define lexical_cachedp(A, ENV)     ((A)->address.stamp == globals_version && (ENV) == global_env && (ENV) == cache_env)
+
+cell lexical_value(cell address, cell env) {
+    cell frame = lexical_frame(address, &env);
+    if (frame != nil) return frame_slot(frame, lexical_slot(address));
+    if (lexical_cachedp(address, env)) {
+        cache_stats.hits++;
+        return cdr(cdr(address));
+    }
+    return lexical_lookup(address, env);
+}
+
+lisp_cache_stats lisp_inline_cache_stats() {
+    return cache_stats;
+}
+
+void lisp_inline_cache_reset() {
+    cache_stats.hits = cache_stats.misses = 0;
+}
+
+cell lexical_assign(cell address, cell val, cell env) {
+    cell frame = lexical_frame(address, &env);
+    if (frame == nil) return set_variable_valueb(lexical_name(address), val, env);
+    return frame_store(frame, lexical_slot(address), val);
+}
+
+
+/**
+ * ----------------------------------------------------------------------
+ * Analysis
+ *
+ * See: https://mitpress.mit.edu/sicp/full-text/book/book-Z-H-26.html#%_sec_4.1.7
+ *
+ * eval works out what an expression is every time it evaluates it. lisp_analyze does that once: each
+ * expression becomes a lisp_node whose `exec' does what eval would do for it, with the pieces of the
+ * special form, the variable or the constant already taken out. Executing the tree makes no decision
+ * about syntax and allocates nothing but values. cond becomes nested ifs and the lambda of a
+ * (define (name params) body) is made during the analysis, not each time the define runs. Lambda
+ * bodies are lexically addressed first, so their variable references keep their inline caches.
+ *
+ * Constant folding
+ * The arithmetic primitives and = are pure, their result depends on nothing but their arguments. A call
+ * of one of them on constant fixnums is made during the analysis and its node answers the value, so
+ * (* 1000 (+ 60 60)) executes without arithmetic or allocation. Like an inline cache the value is
+ * stamped with the version of the globals and the operator's binding is marked cached: once + has been
+ * redefined the node makes its call again. An if, or a cond clause, whose predicate is a literal is
+ * replaced by the branch it takes. Operators are looked up in global_env, the environment a tree is
+ * meant to execute in or extend.
+ *
+ * A tree belongs to a NODE cell and is freed with it, the cells it refers to are marked and moved with
+ * the NODE by the collector. The body of a lambda is a NODE of its own, shared by every procedure the
+ * lambda makes, and apply executes a body that is a NODE instead of evaluating it. NODE cells live in
+ * the pages, never in the nursery or the arena, and lisp_destroy_list leaves them to the collector.
+ */
+#define execute(N, ENV)     ((N)->exec((N), (ENV)))
+
+static cell analyze_failure;    // Why analyze returned NULL
+static cell node_owner;         // The NODE whose tree node_barrier is passing over
+static int  analyze_depth;      // Lambda bodies around the expression being analyzed
+
+static lisp_node *analyze(cell exp);
+
+static lisp_node *node_alloc(cell (*exec)(lisp_node *, cell), cell datum, size_t count) {
+    size_t bytes = sizeof(lisp_node) + sizeof(lisp_node *) * count;
+    lisp_node *node = quota_charge(0, bytes) ? mem_alloc(bytes) : NULL;
+    if (node == NULL) {
+        analyze_failure = &oom_cell;
+        return NULL;
+    }
+    node->exec = exec;
+    node->datum = datum;
+    node->count = count;
+    node->stamp = 0;
+    for (size_t i = 0; i < count; ++i) node->items[i] = NULL;
+    return node;
+}
+
+static void node_free(lisp_node *node) {
+    if (node == NULL) return;
+    for (size_t i = 0; i < node->count; ++i) node_free(node->items[i]);
+    mem_free(node);
+}
+
+static size_t node_bytes(lisp_node *node) {
+    size_t bytes = sizeof(lisp_node) + sizeof(lisp_node *) * node->count;
+    for (size_t i = 0; i < node->count; ++i) bytes += node_bytes(node->items[i]);
+    return bytes;
+}
+
+static void node_forward(lisp_node *node, cell (*forward)(cell)) {
+    node->datum = forward(node->datum);
+    for (size_t i = 0; i < node->count; ++i) node_forward(node->items[i], forward);
+}
+
+static cell node_barrier(cell c) {
+    return lisp_write_barrier(node_owner, c);
+}
+
+/*
+ * Hand `node' to a new NODE cell. The tree was built before its owner existed, the write barrier sees
+ * every cell it refers to now.
+ */
+static cell mknode(lisp_node *node) {
+    cell result = lisp_alloc(NODE, 0, NULL, nil);
+    if (errorp(result)) {
+        node_free(node);
+        return result;
+    }
+    result->data = node;
+    node_owner = result;
+    node_forward(node, node_barrier);
+    return result;
+}
+
+static cell exec_constant(lisp_node *node, cell env) {
+    (void) env;     // Every exec has the same signature
+    return node->datum;
+}
+
+static cell exec_variable(lisp_node *node, cell env) {
+    return lookup_variable_value(node->datum, env);
+}
+
+static cell exec_lexical(lisp_node *node, cell env) {
+    return lexical_value(node->datum, env);
+}
+
+static cell exec_assignment(lisp_node *node, cell env) {
+    cell value = execute(node->items[0], env);
+    if (errorp(value)) return value;
+    cell result = set_variable_valueb(node->datum, value, env);
+    return errorp(result) ? result : lisp_true;
+}
+
+static cell exec_definition(lisp_node *node, cell env) {
+    cell value = execute(node->items[0], env);
+    if (errorp(value)) return value;
+    cell result = define_variableb(node->datum, value, env);
+    return errorp(result) ? result : lisp_true;
+}
+
+static cell exec_if(lisp_node *node, cell env) {
+    cell predicate = execute(node->items[0], env);
+    if (errorp(predicate)) return predicate;
+    return execute(node->items[truep(predicate) ? 1 : 2], env);
+}
+
+static cell exec_lambda(lisp_node *node, cell env) {
+    return mkprocedure(car(node->datum), cdr(node->datum), env);   // (parameters . body)
+}
+
+static cell exec_sequence(lisp_node *node, cell env) {
+    for (size_t i = 0; i + 1 < node->count; ++i) {
+        cell result = execute(node->items[i], env);
+        if (errorp(result)) return result;
+    }
+    return execute(node->items[node->count - 1], env);
+}
+
+static cell exec_application(lisp_node *node, cell env) {
+    cell proc = execute(node->items[0], env);
+    if (errorp(proc)) return proc;
+    cell arguments = nil, last = nil;
+    for (size_t i = 1; i < node->count; ++i) {
+        cell value = execute(node->items[i], env);
+        if (errorp(value)) return value;
+        cell link = cons(value, nil);
+        if (errorp(link)) return link;
+        if (nullp(arguments))
+            arguments = link;
+        else
+            setcdrb(last, link);
+        last = link;
+    }
+    return apply(proc, arguments);
+}
+
+/*
+ * Primitives whose result depends on nothing but their arguments
+ */
+static cell (*const pure_primitives[])(cell) = { sum, product, subtract, divide, equals };
+
+static bool pure_primitivep(cell proc) {
+    if (!primitive_procp(proc)) return false;
+    for (size_t i = 0; i < N_ELEMENTS(pure_primitives); ++i) {
+        if (primitive_fn(proc) == pure_primitives[i]) return true;
+    }
+    return false;
+}
+
+static cell exec_folded(lisp_node *node, cell env);
+
+/*
+ * The binding of the operator of the application `call', marked cached, if it is a pure primitive of
+ * global_env and every operand is a constant fixnum, or a folded one that is still current. NULL
+ * otherwise: a divisor of 0 is also left for the call to fail on when it runs.
+ */
+static binding_entry *fold_binding(lisp_node *call) {
+    lisp_node *op = call->items[0];
+    cell var = op->datum;
+    if (op->exec == exec_lexical && lexical_freep(var))
+        var = lexical_name(var);
+    else if (op->exec != exec_variable)
+        return NULL;
+    if (call->count < 3 || !bindings_indexp(global_env)) return NULL;
+
+    binding_entry *entry = bindings_find(var);
+    if (entry == NULL || !pure_primitivep(car(entry->vals))) return NULL;
+    for (size_t i = 1; i < call->count; ++i) {
+        lisp_node *operand = call->items[i];
+        if (operand->exec != exec_constant && (operand->exec != exec_folded || operand->stamp != globals_version))
+            return NULL;
+        cell value = execute(operand, global_env);
+        if (lisp_typeof(value) != FIXNUM) return NULL;
+        if (i > 1 && fixnum(value) == 0 && primitive_fn(car(entry->vals)) == divide) return NULL;
+    }
+    entry->cached = true;
+    return entry;
+}
+
+/*
+ * A call folded by the analysis, `datum' is (value) and the only item the call. While the globals are
+ * those the value was computed with it is the answer, otherwise the call is made again and its value
+ * kept if it can still be folded.
+ */
+static cell exec_folded(lisp_node *node, cell env) {
+    if (node->stamp == globals_version) return car(node->datum);
+    lisp_node *call = node->items[0];
+    cell value = execute(call, env);
+    if (errorp(value) || fold_binding(call) == NULL) return value;
+    setcarb(node->datum, value);
+    node->stamp = globals_version;
+    return value;
+}
+
+/*
+ * The application `call' folded into its value, or `call' itself if it cannot be. A symbol in a lambda
+ * body was not addressed because the body defines, it may not be the global.
+ */
+static lisp_node *analyze_fold(lisp_node *call) {
+    if (call == NULL || (call->items[0]->exec == exec_variable && analyze_depth > 0)) return call;
+    if (fold_binding(call) == NULL) return call;
+    cell value = execute(call, global_env);
+    cell box = errorp(value) ? value : cons(value, nil);
+    if (errorp(box)) return call;
+    lisp_node *node = node_alloc(exec_folded, box, 1);
+    if (node == NULL) return call;
+    node->items[0] = call;
+    node->stamp = globals_version;
+    return node;
+}
+
+/*
+ * The branch the if `node' takes if its predicate is a literal, freeing the rest, otherwise `node'
+ */
+static lisp_node *analyze_prune(lisp_node *node) {
+    if (node == NULL) return NULL;
+    lisp_node *predicate = node->items[0];
+    if (predicate->exec != exec_constant || errorp(predicate->datum)) return node;
+    size_t taken = truep(predicate->datum) ? 1 : 2;
+    lisp_node *branch = node->items[taken];
+    node->items[taken] = NULL;
+    node_free(node);
+    return branch;
+}
+
+/*
+ * A node with an item for each element of the list `exps'
+ */
+static lisp_node *analyze_list(cell (*exec)(lisp_node *, cell), cell datum, cell exps) {
+    lisp_node *node = node_alloc(exec, datum, lisp_length(exps));
+    if (node == NULL) return NULL;
+    for (size_t i = 0; i < node->count; ++i, exps = cdr(exps)) {
+        if ((node->items[i] = analyze(car(exps))) == NULL) {
+            node_free(node);
+            return NULL;
+        }
+    }
+    return node;
+}
+
+static lisp_node *analyze_sequence(cell exps) {
+    if (nullp(exps)) return node_alloc(exec_constant, nil, 0);
+    if (last_expp(exps)) return analyze(first_exp(exps));
+    return analyze_list(exec_sequence, nil, exps);
+}
+
+/*
+ * A node of `exec' taking the analysis of `a', `b' and `c', as many of them as `count' says
+ */
+static lisp_node *analyze_items(cell (*exec)(lisp_node *, cell), cell datum, size_t count, cell a, cell b, cell c) {
+    cell exps[] = { a, b, c };
+    lisp_node *node = node_alloc(exec, datum, count);
+    if (node == NULL) return NULL;
+    for (size_t i = 0; i < count; ++i) {
+        if ((node->items[i] = analyze(exps[i])) == NULL) {
+            node_free(node);
+            return NULL;
+        }
+    }
+    return node;
+}
+
+static lisp_node *analyze_lambda(cell exp) {
+    lexical_address(exp);
+    analyze_depth++;
+    lisp_node *body = analyze_sequence(lambda_body(exp));
+    analyze_depth--;
+    if (body == NULL) return NULL;
+    cell code = mknode(body);
+    if (errorp(code)) {
+        analyze_failure = code;
+        return NULL;
+    }
+    cell datum = cons(lambda_parameters(exp), code);
+    if (errorp(datum)) {
+        analyze_failure = datum;
+        return NULL;
+    }
+    return node_alloc(exec_lambda, datum, 0);
+}
+
+/*
+ * The clauses of a cond as nested ifs, see expand_clauses
+ */
+static lisp_node *analyze_clauses(cell clauses) {
+    if (nullp(clauses)) return node_alloc(exec_constant, nil, 0);
+    cell clause = car(clauses);
+    if (cond_elsep(clause)) {
+        if (!nullp(cdr(clauses))) {
+            analyze_failure = mkerror("ELSE clause isn't last cond-if");
+            return NULL;
+        }
+        return analyze_sequence(cond_actions(clause));
+    }
+
+    lisp_node *node = node_alloc(exec_if, nil, 3);
+    if (node == NULL) return NULL;
+    if ((node->items[0] = analyze(cond_predicate(clause))) == NULL ||
+        (node->items[1] = analyze_sequence(cond_actions(clause))) == NULL ||
+        (node->items[2] = analyze_clauses(cdr(clauses))) == NULL) {
+        node_free(node);
+        return NULL;
+    }
+    return analyze_prune(node);
+}
+
+static lisp_node *analyze(cell exp) {
+    if (errorp(exp) || self_evaluatingp(exp))   return node_alloc(exec_constant, exp, 0);
+    if (variablep(exp))                         return node_alloc(exec_variable, exp, 0);
+    if (lexicalp(exp))                          return node_alloc(exec_lexical, exp, 0);
+    if (!pairp(exp)) {
+        analyze_failure = mkerror("Unknown expression type -- ANALYZE");
+        return NULL;
+    }
+
+    switch (special_form(operator(exp))) {
+        case FORM_QUOTE:
+            return node_alloc(exec_constant, cadr(exp), 0);
+        case FORM_SETB:
+            return analyze_items(exec_assignment, assignment_variable(exp), 1, assignment_value(exp), nil, nil);
+        case FORM_DEFINE: {
+            cell value = definition_value(exp);
+            if (errorp(value)) {
+                analyze_failure = value;
+                return NULL;
+            }
+            return analyze_items(exec_definition, definition_variable(exp), 1, value, nil, nil);
+        }
+        case FORM_IF:
+            return analyze_prune(analyze_items(exec_if, nil, 3, if_predicate(exp), if_consequent(exp),
+                                               if_alternate(exp)));
+        case FORM_LAMBDA:
+            return analyze_lambda(exp);
+        case FORM_BEGIN:
+            return analyze_sequence(begin_actions(exp));
+        case FORM_COND:
+            return analyze_clauses(cond_clauses(exp));
+        case FORM_DEFINE_MACRO: {
+            // Defined as it is analyzed, so that the calls analyzed after it are expanded
+            cell result = eval_macro_definition(exp, global_env);
+            if (errorp(result)) {
+                analyze_failure = result;
+                return NULL;
+            }
+            return node_alloc(exec_constant, result, 0);
+        }
+        case FORM_NONE: {
+            cell macro = macro_named(operator(exp));
+            if (nullp(macro)) break;
+            cell expanded = lisp_macroexpand(macro, exp);
+            if (errorp(expanded)) {
+                analyze_failure = expanded;
+                return NULL;
+            }
+            return analyze(expanded);
+        }
+    }
+    return analyze_fold(analyze_list(exec_application, nil, exp));
+}
+
+/*
+ * Analyze `exp' into a NODE, or an ERROR if it cannot be
+ */
+cell lisp_analyze(cell exp) {
+    lisp_node *node = analyze(exp);
+    return node == NULL ? analyze_failure : mknode(node);
+}
+
+cell lisp_execute(cell node, cell env) {
+    if (errorp(node)) return node;
+    if (!nodep(node)) return mkerror("Not an analyzed expression -- EXECUTE");
+    return execute((lisp_node *) node->data, env);
+}
+
+
+/**
+ * ----------------------------------------------------------------------
+ * Bytecode
+ *
+ * lisp_compile translates the forms eval handles into the words of a CODE cell, an opcode followed by
+ * its operands, which lisp_run executes on an operand stack. The machine is threaded: each opcode jumps
+ * straight to the next one through a table of label addresses, unless WITH_SWITCH_DISPATCH asks for a
+ * portable switch. Lambda bodies are compiled into CODE cells of their own, and a call from compiled
+ * code to a procedure with a compiled body pushes a record on the machine's frame stack instead of
+ * recursing in C. Calls in tail position replace the caller's record. Both stacks grow on demand and
+ * are shared by nested runs, which start above whatever the outer run has on them.
+ *
+ * Code that makes no closures and never assigns or defines only ever reads its frame, which cannot be
+ * referred to once the call returns. Such a frame, cell and vector, is carved from the machine's own
+ * blocks of VM_LOCALS_BYTES and given back on return, the collector never sees it. Local variables are
+ * read by lexical address and free ones through their inline caches. The arithmetic primitives and =
+ * are done in place when both operands are fixnums, an argument list is only made for other primitives.
+ *
+ * Compiled top level code is applied with no arguments, and apply runs a compiled body wherever the
+ * procedure is called from. A CODE owns its block and its constants are marked and moved with it by
+ * the collector, it lives in the pages like a NODE.
+ */
+enum lisp_op {
+    OP_CONST,       // k            Push constant k
+    OP_VARIABLE,    // k            Push the value of the symbol constant k
+    OP_LOCAL,       // depth slot   Push a slot of the frame `depth' frames out
+    OP_GLOBAL,      // k            Push the value of the free LEXICAL constant k, through its cache
+    OP_SET,         // k            Assign the top to the variable constant k, replace it by T
+    OP_DEFINE,      // k            Define the variable constant k as the top, replace it by T
+    OP_JUMP,        // to           Continue at word `to'
+    OP_JUMPF,       // to           Pop, continue at word `to' if false
+    OP_POP,         //              Drop the top
+    OP_LAMBDA,      // k            Push a procedure of constant k, (parameters . CODE), closed over env
+    OP_CALL,        // n            Apply the procedure under n arguments, push the result
+    OP_TAILCALL,    // n            Apply the procedure under n arguments in place of the running code
+    OP_RETURN       //              Pop the result and continue in the caller
+};
+
+#define VM_LOCALS_BYTES     4096
+
+typedef struct vm_frame {
+    const int32_t   *pc;
+    lisp_code       *code;
+    cell            env;
+    bool            local;      // `env' is a frame from the machine's blocks
+} vm_frame;
+
+typedef struct vm_block {
+    struct vm_block *prev, *next;
+    size_t          top;
+    double          bytes[VM_LOCALS_BYTES / sizeof(double)];
+} vm_block;
+
+static struct {
+    cell        *stack;         // Operand stack
+    size_t      size, top;
+    vm_frame    *frames;        // Callers of the running code
+    size_t      frames_size, frames_top;
+    vm_block    *locals;        // The block frames are being carved from
+} vm;
+
+static void vm_release() {
+    mem_free(vm.stack);
+    mem_free(vm.frames);
+    while (vm.locals != NULL && vm.locals->prev != NULL) vm.locals = vm.locals->prev;
+    while (vm.locals != NULL) {
+        vm_block *next = vm.locals->next;
+        mem_free(vm.locals);
+        vm.locals = next;
+    }
+    memset(&vm, 0, sizeof(vm));
+}
+
+/*
+ * Room for a frame of `count' slots in the blocks, NULL if it does not fit
+ */
+static cell vm_local_alloc(int32_t count) {
+    size_t bytes = arena_align(sizeof(lisp_cell) + frame_bytes(count));
+    if (bytes > VM_LOCALS_BYTES) return NULL;
+    if (vm.locals == NULL || vm.locals->top + bytes > VM_LOCALS_BYTES) {
+        vm_block *block = vm.locals != NULL ? vm.locals->next : NULL;
+        if (block == NULL) {
+            if ((block = mem_alloc(sizeof(vm_block))) == NULL) return NULL;
+            block->prev = vm.locals;
+            block->next = NULL;
+            if (vm.locals != NULL) vm.locals->next = block;
+        }
+        block->top = 0;
+        vm.locals = block;
+    }
+    cell frame = (cell) ((char *) vm.locals->bytes + vm.locals->top);
+    vm.locals->top += bytes;
+    return frame;
+}
+
+#define vm_blockp(B, F)     ((char *) (F) >= (char *) (B)->bytes && (char *) (F) < (char *) (B)->bytes + VM_LOCALS_BYTES)
+
+/*
+ * Give back the newest frame from the blocks, and everything carved after it
+ */
+static void vm_local_free(cell frame) {
+    while (!vm_blockp(vm.locals, frame)) vm.locals = vm.locals->prev;
+    vm.locals->top = (size_t) ((char *) frame - (char *) vm.locals->bytes);
+}
+
+/*
+ * Give back everything carved since the blocks stood at `top' in `block', or since they were empty
+ * if `block' is NULL
+ */
+static void vm_local_rewind(vm_block *block, size_t top) {
+    if (block == NULL) {
+        for (block = vm.locals; block != NULL && block->prev != NULL; block = block->prev);
+        top = 0;
+    }
+    vm.locals = block;
+    if (block != NULL) block->top = top;
+}
+
+/*
+ * Room for `count' more values above `top' on the operand stack
+ */
+static bool vm_reserve(size_t top, size_t count) {
+    if (top + count <= vm.size) return true;
+    size_t size = vm.size * 2 > top + count ? vm.size * 2 : top + count + 64;
+    cell *stack = mem_realloc(vm.stack, size * sizeof(cell));
+    if (stack == NULL) return false;
+    vm.stack = stack;
+    vm.size = size;
+    return true;
+}
+
+static bool vm_push_frame(const int32_t *pc, lisp_code *code, cell env, bool local) {
+    if (vm.frames_top == vm.frames_size) {
+        size_t size = vm.frames_size * 2 + 16;
+        vm_frame *frames = mem_realloc(vm.frames, size * sizeof(vm_frame));
+        if (frames == NULL) return false;
+        vm.frames = frames;
+        vm.frames_size = size;
+    }
+    vm.frames[vm.frames_top++] = (vm_frame) { pc, code, env, local };
+    return true;
+}
+
+static size_t code_bytes(lisp_code *code) {
+    return sizeof(lisp_code) + sizeof(cell) * code->count + sizeof(int32_t) * code->length;
+}
+
+typedef struct compiler {
+    int32_t     *ops;
+    size_t      length, ops_size;
+    cell        *constants;
+    size_t      count, constants_size;
+    size_t      depth, max;     // Of the operand stack, at the word being emitted and at most
+    bool        keeps_env;      // An OP_LAMBDA, OP_SET or OP_DEFINE was emitted
+    bool        body;           // Compiling the body of a lambda rather than top level code
+    cell        failure;        // Why compiling stopped, NULL while it goes well
+} compiler;
+
+static void compile_exp(compiler *c, cell exp, bool tail);
+static void compile_clauses(compiler *c, cell clauses, bool tail);
+
+static void compile_fail(compiler *c, cell error) {
+    if (c->failure == NULL) c->failure = error;
+}
+
+static void emit(compiler *c, int32_t word) {
+    if (c->length == c->ops_size) {
+        size_t size = c->ops_size * 2 + 16;
+        int32_t *ops = mem_realloc(c->ops, size * sizeof(int32_t));
+        if (ops == NULL) {
+            compile_fail(c, &oom_cell);
+            return;
+        }
+        c->ops = ops;
+        c->ops_size = size;
+    }
+    c->ops[c->length++] = word;
+}
+
+/*
+ * Emit `op' with a single operand, moving the stack depth by `values'
+ */
+static void emit_op(compiler *c, enum lisp_op op, int32_t operand, int values) {
+    emit(c, op);
+    emit(c, operand);
+    c->depth += values;
+    if (c->depth > c->max) c->max = c->depth;
+}
+
+/*
+ * The index of `constant', added to the constants unless it is there already
+ */
+static int32_t constant(compiler *c, cell constant) {
+    for (size_t i = 0; i < c->count; ++i) {
+        if (c->constants[i] == constant) return (int32_t) i;
+    }
+    if (c->count == c->constants_size) {
+        size_t size = c->constants_size * 2 + 8;
+        cell *constants = mem_realloc(c->constants, size * sizeof(cell));
+        if (constants == NULL) {
+            compile_fail(c, &oom_cell);
+            return 0;
+        }
+        c->constants = constants;
+        c->constants_size = size;
+    }
+    c->constants[c->count] = constant;
+    return (int32_t) c->count++;
+}
+
+/*
+ * The value of an expression in tail position is returned, by RETURN or by a TAILCALL
+ */
+static void compile_return(compiler *c, bool tail) {
+    if (tail) {
+        emit(c, OP_RETURN);
+        c->depth--;
+    }
+}
+
+static void compile_value(compiler *c, enum lisp_op op, cell operand, bool tail) {
+    emit_op(c, op, constant(c, operand), 1);
+    compile_return(c, tail);
+}
+
+static void compile_sequence(compiler *c, cell exps, bool tail) {
+    if (nullp(exps)) {
+        compile_value(c, OP_CONST, nil, tail);
+        return;
+    }
+    for (; !last_expp(exps); exps = rest_exps(exps)) {
+        compile_exp(c, first_exp(exps), false);
+        emit(c, OP_POP);
+        c->depth--;
+    }
+    compile_exp(c, first_exp(exps), tail);
+}
+
+/*
+ * The predicate of an if and a jump over its consequent, to be set by compile_alternate
+ */
+static size_t compile_predicate(compiler *c, cell predicate) {
+    compile_exp(c, predicate, false);
+    emit_op(c, OP_JUMPF, 0, -1);
+    return c->length - 1;
+}
+
+/*
+ * Follow the consequent with a jump over the alternate unless it returned, the alternate starts with
+ * the stack as it was before the consequent
+ */
+static size_t compile_alternate(compiler *c, size_t to_alternate, size_t depth, bool tail) {
+    size_t to_end = 0;
+    if (!tail) {
+        emit_op(c, OP_JUMP, 0, 0);
+        to_end = c->length - 1;
+    }
+    if (c->failure == NULL) c->ops[to_alternate] = (int32_t) c->length;
+    c->depth = depth;
+    return to_end;
+}
+
+static void compile_end(compiler *c, size_t to_end, bool tail) {
+    if (!tail && c->failure == NULL) c->ops[to_end] = (int32_t) c->length;
+}
+
+/*
+ * The clauses of a cond as nested ifs, see expand_clauses
+ */
+static void compile_clauses(compiler *c, cell clauses, bool tail) {
+    if (nullp(clauses)) {
+        compile_value(c, OP_CONST, nil, tail);
+        return;
+    }
+    cell clause = car(clauses);
+    if (cond_elsep(clause)) {
+        if (!nullp(cdr(clauses)))
+            compile_fail(c, mkerror("ELSE clause isn't last cond-if"));
+        else
+            compile_sequence(c, cond_actions(clause), tail);
+        return;
+    }
+    size_t depth = c->depth, to_alternate = compile_predicate(c, cond_predicate(clause));
+    compile_sequence(c, cond_actions(clause), tail);
+    size_t to_end = compile_alternate(c, to_alternate, depth, tail);
+    compile_clauses(c, cdr(clauses), tail);
+    compile_end(c, to_end, tail);
+}
+
+/*
+ * Hand what `c' compiled to a new CODE cell and release the compiler
+ */
+static cell compile_finish(compiler *c) {
+    cell result = c->failure;
+    lisp_code *code = NULL;
+    if (result == NULL) {
+        size_t bytes = sizeof(lisp_code) + sizeof(cell) * c->count + sizeof(int32_t) * c->length;
+        code = quota_charge(0, bytes) ? mem_alloc(bytes) : NULL;
+        result = code == NULL ? &oom_cell : lisp_alloc(CODE, 0, NULL, nil);
+    }
+    if (!errorp(result)) {
+        code->length = c->length;
+        code->count = c->count;
+        code->depth = c->max;
+        code->keeps_env = c->keeps_env;
+        code->ops = (int32_t *) &code->constants[c->count];
+        memcpy(code->ops, c->ops, sizeof(int32_t) * c->length);
+        result->data = code;
+        // The constants were gathered before their owner existed
+        for (size_t i = 0; i < c->count; ++i) code->constants[i] = lisp_write_barrier(result, c->constants[i]);
+    } else {
+        mem_free(code);
+    }
+    mem_free(c->ops);
+    mem_free(c->constants);
+    return result;
+}
+
+static cell compile_lambda(cell exp) {
+    lexical_address(exp);
+    compiler body = {0};
+    body.body = true;
+    compile_sequence(&body, lambda_body(exp), true);
+    cell code = compile_finish(&body);
+    if (errorp(code)) return code;
+    return cons(lambda_parameters(exp), code);
+}
+
+static void compile_application(compiler *c, cell exp, bool tail) {
+    int32_t count = 0;
+    compile_exp(c, operator(exp), false);
+    for (cell operands = operands(exp); pairp(operands); operands = cdr(operands), ++count) {
+        compile_exp(c, car(operands), false);
+    }
+    emit_op(c, tail ? OP_TAILCALL : OP_CALL, count, -count - (tail ? 1 : 0));
+}
+
+static void compile_exp(compiler *c, cell exp, bool tail) {
+    if (c->failure != NULL) return;
+    if (errorp(exp) || self_evaluatingp(exp)) {
+        compile_value(c, OP_CONST, exp, tail);
+    } else if (variablep(exp) && !c->body) {
+        // Nothing at top level can shadow a global, the reference may as well have an inline cache
+        cell address = mklexical(0, LEXICAL_FREE, exp);
+        compile_value(c, errorp(address) ? OP_VARIABLE : OP_GLOBAL, errorp(address) ? exp : address, tail);
+    } else if (variablep(exp)) {
+        compile_value(c, OP_VARIABLE, exp, tail);
+    } else if (lexicalp(exp) && lexical_slot(exp) == LEXICAL_FREE) {
+        compile_value(c, OP_GLOBAL, exp, tail);
+    } else if (lexicalp(exp)) {
+        emit_op(c, OP_LOCAL, lexical_depth(exp), 1);
+        emit(c, lexical_slot(exp));
+        compile_return(c, tail);
+    } else if (!pairp(exp)) {
+        compile_fail(c, mkerror("Unknown expression type -- COMPILE"));
+    } else {
+        switch (special_form(operator(exp))) {
+            case FORM_QUOTE:
+                compile_value(c, OP_CONST, cadr(exp), tail);
+                break;
+            case FORM_SETB:
+                compile_exp(c, assignment_value(exp), false);
+                emit_op(c, OP_SET, constant(c, assignment_variable(exp)), 0);
+                c->keeps_env = true;
+                compile_return(c, tail);
+                break;
+            case FORM_DEFINE: {
+                cell value = definition_value(exp);     // The lambda of (define (name params) body) is made once
+                if (errorp(value)) {
+                    compile_fail(c, value);
+                    break;
+                }
+                compile_exp(c, value, false);
+                emit_op(c, OP_DEFINE, constant(c, definition_variable(exp)), 0);
+                c->keeps_env = true;
+                compile_return(c, tail);
+                break;
+            }
+            case FORM_IF: {
+                size_t depth = c->depth, to_alternate = compile_predicate(c, if_predicate(exp));
+                compile_exp(c, if_consequent(exp), tail);
+                size_t to_end = compile_alternate(c, to_alternate, depth, tail);
+                compile_exp(c, if_alternate(exp), tail);
+                compile_end(c, to_end, tail);
+                break;
+            }
+            case FORM_LAMBDA: {
+                cell procedure = compile_lambda(exp);
+                if (errorp(procedure))
+                    compile_fail(c, procedure);
+                else
+                    compile_value(c, OP_LAMBDA, procedure, tail);
+                c->keeps_env = true;
+                break;
+            }
+            case FORM_BEGIN:
+                compile_sequence(c, begin_actions(exp), tail);
+                break;
+            case FORM_COND:
+                compile_clauses(c, cond_clauses(exp), tail);
+                break;
+            case FORM_DEFINE_MACRO: {
+                // Defined as it is compiled, so that the calls compiled after it are expanded
+                cell result = eval_macro_definition(exp, global_env);
+                if (errorp(result))
+                    compile_fail(c, result);
+                else
+                    compile_value(c, OP_CONST, result, tail);
+                break;
+            }
+            case FORM_NONE: {
+                cell macro = macro_named(operator(exp)), expanded;
+                if (nullp(macro))
+                    compile_application(c, exp, tail);
+                else if (errorp(expanded = lisp_macroexpand(macro, exp)))
+                    compile_fail(c, expanded);
+                else
+                    compile_exp(c, expanded, tail);
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Compile `exp' into a CODE cell, or an ERROR if it cannot be
+ */
+cell lisp_compile(cell exp) {
+    if (errorp(exp)) return exp;
+    compiler c = {0};
+    compile_exp(&c, exp, true);
+    return compile_finish(&c);
+}
+
+cell compile(cell parms) {
+    return lisp_compile(car(parms));
+}
+
+/*
+ * The arguments on top of the stack as a list
+ */
+static cell vm_arguments(cell *args, int32_t count) {
+    cell list = nil;
+    while (count-- > 0) {
+        list = cons(args[count], list);
+        if (errorp(list)) break;
+    }
+    return list;
+}
+
+/*
+ * The arithmetic primitives and = applied to two fixnums without making an argument list. NULL for
+ * anything else.
+ */
+static cell vm_arithmetic(cell proc, cell lhs, cell rhs) {
+    if (lisp_typeof(lhs) != FIXNUM || lisp_typeof(rhs) != FIXNUM) return NULL;
+    cell (*fn)(cell) = primitive_fn(proc);
+    if (fn == sum)        return mkfixnum(fixnum(lhs) + fixnum(rhs));
+    if (fn == subtract)   return mkfixnum(fixnum(lhs) - fixnum(rhs));
+    if (fn == product)    return mkfixnum(fixnum(lhs) * fixnum(rhs));
+    if (fn == equals)     return fixnum(lhs) == fixnum(rhs) ? lisp_true : nil;
+    return NULL;
+}
+
+/*
+ * A FRAME binding the parameters of `proc' to the `count' values at `args'. If `local' is set it is
+ * carved from the machine's blocks when it fits, `local' is cleared if it did not.
+ */
+static cell vm_frame_make(cell proc, cell *args, int32_t count, bool *local) {
+    cell params = procedure_parameters(proc);
+    int32_t arity = 0;
+    for (cell p = params; pairp(p); p = cdr(p)) arity++;
+    if (count > arity) return mkerror("Too many arguments supplied -- EXTEND_ENVIRONMENT");
+    if (count < arity) return mkerror("Too few arguments supplied -- EXTEND_ENVIRONMENT");
+
+    cell frame = *local ? vm_local_alloc(count) : NULL;
+    if (frame != NULL) {
+        // Never seen by the collector, nor by the write barrier
+        lisp_frame *vector = (lisp_frame *) (frame + 1);
+        frame->type = FRAME;
+        frame->data = vector;
+        frame->rest = procedure_environment(proc);
+        vector->names = params;
+        vector->size = vector->count = (size_t) count;
+        memcpy(vector->slots, args, sizeof(cell) * count);
+        return frame;
+    }
+    *local = false;
+    frame = frame_make(params, count, procedure_environment(proc));
+    if (errorp(frame)) return frame;
+    lisp_frame *vector = frame_vector(frame);
+    for (; vector->count < (size_t) count; vector->count++) {
+        vector->slots[vector->count] = lisp_write_barrier(frame, args[vector->count]);
+    }
+    return frame;
+}
+
+#if defined(__GNUC__) && !defined(WITH_SWITCH_DISPATCH)
+#define VM_THREADED
+#define VM_CASE(OP)     label_##OP:
+#define VM_NEXT         goto *labels[*pc++]
+#else
+#define VM_CASE(OP)     case OP:
+#define VM_NEXT         continue
+#endif
+
+// The running code, set when it starts and when a call or a return changes it
+#define VM_ENTER(CODE, PC)  (code = (CODE), constants = code->constants, pc = (PC))
+
+// Anything called out of the machine may run code of its own above the values in use
+#define VM_SAVE()           (vm.top = (size_t) (sp - vm.stack))
+#define VM_LOAD()           (sp = vm.stack + vm.top)
+
+cell lisp_run(cell exp, cell env) {
+    if (errorp(exp)) return exp;
+    if (!codep(exp)) return mkerror("Not compiled code -- RUN");
+
+#ifdef VM_THREADED
+    static void *labels[] = {
+        [OP_CONST] = &&label_OP_CONST, [OP_VARIABLE] = &&label_OP_VARIABLE, [OP_LOCAL] = &&label_OP_LOCAL,
+        [OP_GLOBAL] = &&label_OP_GLOBAL, [OP_SET] = &&label_OP_SET, [OP_DEFINE] = &&label_OP_DEFINE,
+        [OP_JUMP] = &&label_OP_JUMP, [OP_JUMPF] = &&label_OP_JUMPF, [OP_POP] = &&label_OP_POP,
+        [OP_LAMBDA] = &&label_OP_LAMBDA, [OP_CALL] = &&label_OP_CALL, [OP_TAILCALL] = &&label_OP_TAILCALL,
+        [OP_RETURN] = &&label_OP_RETURN
+    };
+#endif
+    size_t base = vm.top, frames = vm.frames_top;
+    vm_block *locals = vm.locals;
+    size_t locals_top = locals != NULL ? locals->top : 0;
+    lisp_code *code;
+    cell *constants, *sp, value, proc;
+    const int32_t *pc;
+    int32_t count;
+    bool tail, local = false;
+
+    VM_ENTER((lisp_code *) exp->data, ((lisp_code *) exp->data)->ops);
+    if (!vm_reserve(base, code->depth)) return &oom_cell;
+    sp = vm.stack + base;
+
+#ifdef VM_THREADED
+    VM_NEXT;
+#else
+    for (;;) switch (*pc++) {
+#endif
+    VM_CASE(OP_CONST)
+        *sp++ = constants[*pc++];
+        VM_NEXT;
+    VM_CASE(OP_VARIABLE)
+        value = lookup_variable_value(constants[*pc++], env);
+        if (errorp(value)) goto fail;
+        *sp++ = value;
+        VM_NEXT;
+    VM_CASE(OP_LOCAL) {
+        cell frame = env;
+        for (int32_t depth = *pc++; depth > 0; --depth) frame = enclosing_environment(frame);
+        *sp++ = frame_slot(frame, *pc++);
+        VM_NEXT;
+    }
+    VM_CASE(OP_GLOBAL) {
+        cell address = constants[*pc++], scope = env;
+        for (int32_t depth = lexical_depth(address); depth > 0; --depth) scope = enclosing_environment(scope);
+        if (lexical_cachedp(address, scope)) {
+            cache_stats.hits++;
+            value = cdr(cdr(address));
+        } else if (errorp(value = lexical_lookup(address, scope))) {
+            goto fail;
+        }
+        *sp++ = value;
+        VM_NEXT;
+    }
+    VM_CASE(OP_SET)
+        value = set_variable_valueb(constants[*pc++], sp[-1], env);
+        if (errorp(value)) goto fail;
+        sp[-1] = lisp_true;
+        VM_NEXT;
+    VM_CASE(OP_DEFINE)
+        value = define_variableb(constants[*pc++], sp[-1], env);
+        if (errorp(value)) goto fail;
+        sp[-1] = lisp_true;
+        VM_NEXT;
+    VM_CASE(OP_JUMP)
+        pc = code->ops + *pc;
+        VM_NEXT;
+    VM_CASE(OP_JUMPF)
+        pc = truep(*--sp) ? pc + 1 : code->ops + *pc;
+        VM_NEXT;
+    VM_CASE(OP_POP)
+        --sp;
+        VM_NEXT;
+    VM_CASE(OP_LAMBDA)
+        value = constants[*pc++];
+        value = mkprocedure(car(value), cdr(value), env);
+        if (errorp(value)) goto fail;
+        *sp++ = value;
+        VM_NEXT;
+    VM_CASE(OP_TAILCALL)
+        tail = true;
+        goto call;
+    VM_CASE(OP_CALL)
+        tail = false;
+    call:
+        count = *pc++;
+        sp -= count + 1;
+        proc = sp[0];
+        if (primitive_procp(proc)) {
+            value = count == 2 ? vm_arithmetic(proc, sp[1], sp[2]) : NULL;
+            if (value == NULL) {
+                value = vm_arguments(sp + 1, count);
+                if (errorp(value)) goto fail;
+                VM_SAVE();
+                value = primitive_call(proc, value);
+                VM_LOAD();
+            }
+        } else if ((compound_procp(proc) && codep(procedure_body(proc))) || (codep(proc) && count == 0)) {
+            // Continue in the compiled body rather than recursing
+            cell callee = codep(proc) ? proc : procedure_body(proc);
+            lisp_code *next = callee->data;
+            if (!tail && !vm_push_frame(pc, code, env, local)) {
+                value = &oom_cell;
+                goto fail;
+            }
+            if (tail && local) vm_local_free(env);     // The arguments are on the operand stack
+            local = !codep(proc) && !next->keeps_env;
+            cell frame = codep(proc) ? global_env : vm_frame_make(proc, sp + 1, count, &local);
+            if (errorp(frame)) {
+                value = frame;
+                goto fail;
+            }
+            VM_SAVE();
+            if (!vm_reserve(vm.top, next->depth)) {
+                value = &oom_cell;
+                goto fail;
+            }
+            VM_LOAD();
+            VM_ENTER(next, next->ops);
+            env = frame;
+            VM_NEXT;
+        } else {
+            value = vm_arguments(sp + 1, count);
+            if (errorp(value)) goto fail;
+            VM_SAVE();
+            value = apply(proc, value);
+            VM_LOAD();
+        }
+        if (errorp(value)) goto fail;
+        if (tail) goto finish;
+        *sp++ = value;
+        VM_NEXT;
+    VM_CASE(OP_RETURN)
+        value = *--sp;
+    finish:
+        if (local) vm_local_free(env);
+        if (vm.frames_top == frames) {
+            vm.top = base;
+            return value;
+        }
+        vm_frame *caller = &vm.frames[--vm.frames_top];
+        VM_ENTER(caller->code, caller->pc);
+        env = caller->env;
+        local = caller->local;
+        *sp++ = value;
+        VM_NEXT;
+#ifndef VM_THREADED
+    }
+#endif
 
-    return mklist_from_array(N_ELEMENTS(c), c);
+fail:
+    vm.top = base;
+    vm.frames_top = frames;
+    vm_local_rewind(locals, locals_top);
+    return value;
 }
 
-cell setup_environment() {
-    cell initial = extend_environment(
-            primitive_procedure_names(),
-            primitive_procedure_objects(),
-            the_empty_environment);
-    define_variableb(mksym("true"), mkfixnum(1), initial);
-    define_variableb(mksym("false"), nil, initial);
-    return initial;
-}
 
-cell extend_environment(cell vars, cell vals, cell base_env) {
-    if (lisp_length(vars) == lisp_length(vals))
-        return cons(mkframe(vars, vals), base_env);
-    else if (lisp_length(vars) < lisp_length(vals))
-        return mkerror("Too many arguments supplied -- EXTEND_ENVIRONMENT");
-    else
-        return mkerror("Too few arguments supplied -- EXTEND_ENVIRONMENT");
-}
+/**
+ * ----------------------------------------------------------------------
+ * Explicit control
+ *
+ * See: https://mitpress.mit.edu/sicp/full-text/book/book-Z-H-34.html
+ *
+ * The evaluator of SICP 5.4 as a register machine: eval's recursion is replaced by saving registers and the
+ * label to continue at on a stack of cons cells in the heap, and by going to a label rather than calling.
+ * How deep a program recurses is bounded by the heap and by the most entries the stack may hold, rather
+ * than by the C stack, and going past that bound is an ERROR cell. Arguments are accumulated in reverse
+ * and turned round in place before the procedure is applied. Procedures whose bodies were analyzed or
+ * compiled, and primitives, are handed to apply.
+ *
+ * Every save conses, so as the compiler of SICP 5.5 does the machine saves only around what needs it:
+ * constants, variables and quotations in operator, operand or predicate position are evaluated in place.
+ */
+enum ec_label {
+    EC_DISPATCH,            // Evaluate `exp' in `env'
+    EC_IF_DECIDE,           // `val' holds the predicate
+    EC_ASSIGNMENT,          // `val' holds the value to assign
+    EC_DEFINITION,          // `val' holds the value to define
+    EC_OPERATOR,            // `val' holds the procedure
+    EC_EXPAND,              // `proc' is a macro, `exp' the call of it
+    EC_OPERAND_LOOP,        // Evaluate the operands left in `unev' for `proc', after those in `argl'
+    EC_ACCUMULATE,          // `val' holds an operand, more to come
+    EC_ACCUMULATE_LAST,     // `val' holds the last operand
+    EC_APPLY,               // Apply `proc' to `argl'
+    EC_SEQUENCE,            // Evaluate the expressions in `unev'
+    EC_SEQUENCE_CONTINUE,   // `val' holds the value of one of them, not the last
+    EC_DONE                 // `val' holds the result
+};
 
+typedef struct ec_machine {
+    cell exp, env, val, proc, argl, unev;
+    enum ec_label cont;     // Where `val' goes once computed
+    cell stack;             // Saved registers, a list
+    size_t depth;           // Entries in `stack'
+    enum ec_label label;    // Where the machine is
+    size_t budget;          // Steps it may take before it suspends
+} ec_machine;
 
-cell env_loop(cell env, cell var);
-cell env_loop2(cell env, cell var, cell val);
-cell scan_aux(cell vars, cell vals, cell var, cell env) {
-    if (nullp(vars))
-        return env_loop(enclosing_environment(env), var);
-    else if (lisp_equals(var, car(vars)))
-        return car(vals);
-    else
-        return scan_aux(cdr(vars), cdr(vals), var, env);
-}
+static size_t ec_max_depth = LISP_EC_DEPTH;
 
-cell scan_aux2(cell vars, cell vals, cell var, cell val, cell env) {
-    if (nullp(vars))
-        return env_loop(enclosing_environment(env), var);
-    else if (lisp_equals(var, car(vars)))
-        return setcarb(vals, val);
-    else
-        return scan_aux2(cdr(vars), cdr(vals), var, val, env);
+size_t lisp_ec_max_depth(size_t depth) {
+    size_t previous = ec_max_depth;
+    ec_max_depth = depth;
+    return previous;
 }
 
-cell env_loop(cell env, cell var) {
-    if (env == the_empty_environment)
-        return mkerror("Unbound Variable -- lookup_variable_value");
-    else {
-        cell frame = first_frame(env);
-        return scan_aux(frame_variables(frame), frame_values(frame), var, env);
+static bool ec_save(ec_machine *m, cell value) {
+    cell stack;
+    if (m->depth >= ec_max_depth) {
+        m->val = mkerror("Maximum recursion depth exceeded -- EVAL");
+        return false;
     }
-}
-
-cell env_loop2(cell env, cell var, cell val) {
-    if (env == the_empty_environment)
-        return mkerror("Unbound Variable -- set_variable_valueb");
-    else {
-        cell frame = first_frame(env);
-        return scan_aux2(frame_variables(frame), frame_values(frame), var, val, env);
+    if (errorp(value) || errorp(stack = cons(value, m->stack))) {
+        m->val = errorp(value) ? value : stack;
+        return false;
     }
+    m->stack = stack;
+    m->depth++;
+    return true;
 }
 
-cell lookup_variable_value(cell var, cell env) {
-    return env_loop(env, var);
+static cell ec_restore(ec_machine *m) {
+    cell value = car(m->stack);
+    m->stack = cdr(m->stack);
+    m->depth--;
+    return value;
 }
 
-cell set_variable_valueb(cell var, cell val, cell env) {
-    return env_loop2(env, var, val);
+#define ec_save_label(M, L)     ec_save(M, mkfixnum(L))
+#define ec_restore_label(M)     ((enum ec_label) fixnum(ec_restore(M)))
+
+/*
+ * Turn round the list `list' in place, it was consed by the machine and nothing else refers to it
+ */
+static cell ec_reverse(cell list) {
+    cell reversed = nil;
+    while (!nullp(list)) {
+        cell next = cdr(list);
+        setcdrb(list, reversed);
+        reversed = list;
+        list = next;
+    }
+    return reversed;
 }
 
-cell def_variable_aux(cell vars,cell vals, cell var, cell val, cell frame) {
-    bool should_define = nullp(vars);
-    bool found = lisp_equals(var, car(vars));
-    if (should_define)
-        return add_binding_to_frameb(var, val, frame);
-    else if (found)
-        return setcarb(vals, val);
+/*
+ * Evaluate `exp' into `val' if it needs nothing of the machine
+ */
+static bool ec_simple(cell exp, cell env, cell *val) {
+    if (errorp(exp) || self_evaluatingp(exp))
+        *val = exp;
+    else if (variablep(exp))
+        *val = lookup_variable_value(exp, env);
+    else if (lexicalp(exp))
+        *val = lexical_value(exp, env);
+    else if (pairp(exp) && special_form(operator(exp)) == FORM_QUOTE)
+        *val = cadr(exp);
     else
-        return def_variable_aux(cdr(vars), cdr(vals), var, val, frame);
+        return false;
+    return true;
 }
 
-cell define_variableb(cell var, cell val, cell env) {
-    cell frame = first_frame(env);
-    return def_variable_aux(frame_variables(frame), frame_values(frame), var, val, frame);
-}
+/*
+ * Run the machine from its label until it has a result, or NULL if it ran out of steps first. A step is
+ * going to a label.
+ */
+static cell ec_run(ec_machine *m) {
+    enum ec_label label = m->label;
+    cell exp;
 
-cell apply(cell procedure, cell arguments) {
-    if (primitive_procp(procedure)) {
-        return primitive_call(procedure, arguments);
-    } else if (compound_procp(procedure)) {
-        return eval_sequence(
-                procedure_body(procedure),
-                (extend_environment(procedure_parameters(procedure),
-                  arguments, procedure_environment(procedure))));
-    }
-    return mkerror("Unknown procedure type - APPLY");
-}
+    for (;;) {
+        if (m->budget-- == 0) {
+            m->label = label;
+            return NULL;
+        }
+        switch (label) {
+            case EC_DISPATCH:
+                exp = m->exp;
+                if (ec_simple(exp, m->env, &m->val)) break;
+                if (pairp(exp)) {
+                    switch (special_form(operator(exp))) {
+                        case FORM_SETB:
+                        case FORM_DEFINE:
+                            if (!ec_save(m, exp) || !ec_save(m, m->env) || !ec_save_label(m, m->cont)) goto fail;
+                            if (special_form(operator(exp)) == FORM_SETB) {
+                                m->cont = EC_ASSIGNMENT;
+                                m->exp = assignment_value(exp);
+                            } else {
+                                m->cont = EC_DEFINITION;
+                                m->exp = definition_value(exp);
+                            }
+                            continue;
+                        case FORM_IF:
+                            if (ec_simple(if_predicate(exp), m->env, &m->val)) {
+                                if (errorp(m->val)) goto fail;
+                                m->exp = truep(m->val) ? if_consequent(exp) : if_alternate(exp);
+                                continue;
+                            }
+                            if (!ec_save(m, exp) || !ec_save(m, m->env) || !ec_save_label(m, m->cont)) goto fail;
+                            m->cont = EC_IF_DECIDE;
+                            m->exp = if_predicate(exp);
+                            continue;
+                        case FORM_LAMBDA:
+                            m->val = mkprocedure(lambda_parameters(exp), lambda_body(lexical_address(exp)), m->env);
+                            goto next;
+                        case FORM_BEGIN:
+                            if (!ec_save_label(m, m->cont)) goto fail;
+                            m->unev = begin_actions(exp);
+                            label = EC_SEQUENCE;
+                            continue;
+                        case FORM_COND:
+                            m->exp = lisp_splice(exp, cond_if(exp));
+                            continue;
+                        case FORM_DEFINE_MACRO:
+                            m->val = eval_macro_definition(exp, m->env);
+                            goto next;
+                        case FORM_QUOTE:
+                        case FORM_NONE:
+                            break;
+                    }
+                }
+                if (!applicationp(exp)) {
+                    m->val = mkerror("Unknown expression type -- EVAL");
+                    break;
+                }
+                // The label to continue at once the procedure has been applied
+                if (!ec_save_label(m, m->cont)) goto fail;
+                m->unev = operands(exp);
+                m->argl = nil;
+                if (ec_simple(operator(exp), m->env, &m->proc)) {
+                    if (errorp(m->proc)) {
+                        m->val = m->proc;
+                        goto fail;
+                    }
+                    label = macrop(m->proc) ? EC_EXPAND : EC_OPERAND_LOOP;
+                    continue;
+                }
+                if (!ec_save(m, m->env) || !ec_save(m, exp)) goto fail;
+                m->exp = operator(exp);
+                m->cont = EC_OPERATOR;
+                continue;
 
-bool self_evaluatingp(cell exp) {
-    return (exp->type == STRING || numberp(exp) || nullp(exp));
-}
+            case EC_OPERATOR:
+                m->exp = exp = ec_restore(m);
+                m->env = ec_restore(m);
+                m->unev = operands(exp);
+                m->argl = nil;      // The operator's own call left its arguments here
+                m->proc = m->val;
+                label = macrop(m->proc) ? EC_EXPAND : EC_OPERAND_LOOP;
+                continue;
 
-bool variablep(cell exp) {
-    return symbolp(exp);
-}
+            case EC_EXPAND:
+                // The call in `exp' becomes its expansion, evaluated where the call would have been. It is read from
+                // the machine, as the run may have been suspended and resumed since the call was dispatched
+                m->val = lisp_macroexpand(m->proc, m->exp);
+                if (errorp(m->val)) goto fail;
+                m->cont = ec_restore_label(m);
+                label = EC_DISPATCH;
+                continue;
 
-cell definition_variable(cell exp) {
-    if(symbolp(cadr(exp)))
-        return (cadr(exp));
-    else
-        return (caadr(exp));
-}
+            case EC_OPERAND_LOOP:
+                for (; !no_operandsp(m->unev); m->unev = rest_operands(m->unev)) {
+                    if (!ec_simple(first_operand(m->unev), m->env, &m->val)) break;
+                    if (errorp(m->val) || errorp(m->argl = cons(m->val, m->argl))) {
+                        m->val = errorp(m->val) ? m->val : m->argl;
+                        goto fail;
+                    }
+                }
+                if (no_operandsp(m->unev)) {
+                    m->argl = ec_reverse(m->argl);
+                    label = EC_APPLY;
+                    continue;
+                }
+                if (!ec_save(m, m->proc) || !ec_save(m, m->argl)) goto fail;
+                m->exp = first_operand(m->unev);
+                if (no_operandsp(rest_operands(m->unev))) {
+                    m->cont = EC_ACCUMULATE_LAST;
+                } else {
+                    if (!ec_save(m, m->env) || !ec_save(m, m->unev)) goto fail;
+                    m->cont = EC_ACCUMULATE;
+                }
+                label = EC_DISPATCH;
+                continue;
 
-cell definition_value(cell exp) {
-    if(symbolp(cadr(exp)))
-        return (caddr(exp));
-    else
-        return mklambda(cdadr(exp), cddr(exp));
-}
+            case EC_ACCUMULATE:
+            case EC_ACCUMULATE_LAST:
+                if (label == EC_ACCUMULATE) {
+                    m->unev = rest_operands(ec_restore(m));
+                    m->env = ec_restore(m);
+                } else {
+                    m->unev = nil;
+                }
+                m->argl = cons(m->val, ec_restore(m));
+                m->proc = ec_restore(m);
+                if (errorp(m->argl)) {
+                    m->val = m->argl;
+                    goto fail;
+                }
+                label = EC_OPERAND_LOOP;
+                continue;
 
-cell if_alternate(cell exp) {
-    if (!nullp(cdddr(exp)))
-        return cadddr(exp);
-    return nil;
+            case EC_APPLY:
+                // The label to continue at is on the stack, saved before the operator was evaluated
+                if (compound_procp(m->proc) && pairp(procedure_body(m->proc))) {
+                    m->env = extend_environment(procedure_parameters(m->proc), m->argl,
+                                                procedure_environment(m->proc));
+                    if (errorp(m->env)) {
+                        m->val = m->env;
+                        goto fail;
+                    }
+                    m->unev = procedure_body(m->proc);
+                    label = EC_SEQUENCE;
+                    continue;
+                }
+                m->val = apply(m->proc, m->argl);
+                m->cont = ec_restore_label(m);
+                break;
+
+            case EC_SEQUENCE:
+                if (nullp(m->unev)) {
+                    m->val = nil;
+                    m->cont = ec_restore_label(m);
+                    break;
+                }
+                m->exp = first_exp(m->unev);
+                if (last_expp(m->unev)) {
+                    m->cont = ec_restore_label(m);      // A tail call, nothing is left to come back to
+                } else {
+                    if (!ec_save(m, m->unev) || !ec_save(m, m->env)) goto fail;
+                    m->cont = EC_SEQUENCE_CONTINUE;
+                }
+                label = EC_DISPATCH;
+                continue;
+
+            case EC_SEQUENCE_CONTINUE:
+                m->env = ec_restore(m);
+                m->unev = rest_exps(ec_restore(m));
+                label = EC_SEQUENCE;
+                continue;
+
+            case EC_IF_DECIDE:
+                m->cont = ec_restore_label(m);
+                m->env = ec_restore(m);
+                exp = ec_restore(m);
+                m->exp = truep(m->val) ? if_consequent(exp) : if_alternate(exp);
+                label = EC_DISPATCH;
+                continue;
+
+            case EC_ASSIGNMENT:
+            case EC_DEFINITION:
+                m->cont = ec_restore_label(m);
+                m->env = ec_restore(m);
+                exp = ec_restore(m);
+                if (label == EC_ASSIGNMENT)
+                    m->val = set_variable_valueb(assignment_variable(exp), m->val, m->env);
+                else
+                    m->val = define_variableb(definition_variable(exp), m->val, m->env);
+                if (!errorp(m->val)) m->val = lisp_true;
+                break;
+
+            case EC_DONE:
+                return m->val;
+        }
+    next:
+        // `val' is ready for whatever `cont' says comes next, unless it is an ERROR that ends the evaluation
+        if (errorp(m->val)) goto fail;
+        label = m->cont;
+    }
+
+fail:
+    m->stack = nil;
+    m->depth = 0;
+    return m->val;
 }
 
-cell mkif(cell predicate, cell consequent, cell altnerate) {
-    return cons(lisp_if, cons(predicate, cons(consequent, altnerate)));
+cell lisp_ec_eval(cell exp, cell env) {
+    ec_machine m = { exp, env, nil, nil, nil, nil, EC_DONE, nil, 0, EC_DISPATCH, SIZE_MAX };
+    return ec_run(&m);
 }
 
+/*
+ * Suspension
+ * A machine that ran out of steps is kept as one list in the heap, its registers followed by its stack,
+ * and that list is rooted until the machine is resumed. The collectors may run in between and move it.
+ */
+#define EC_SUSPENDED    9   // Registers kept ahead of the stack
 
-cell mkbegin(cell seq) {
-    return cons(lisp_begin, seq);
+static cell ec_suspend(ec_machine *m) {
+    cell registers[EC_SUSPENDED] = {
+        m->exp, m->env, m->val, m->proc, m->argl, m->unev,
+        mkfixnum(m->cont), mkfixnum(m->label), mkfixnum((lisp_fixnum) m->depth)
+    };
+    cell machine = m->stack;
+    for (int i = EC_SUSPENDED - 3; i < EC_SUSPENDED; ++i) {
+        if (errorp(registers[i])) return registers[i];
+    }
+    for (int i = EC_SUSPENDED - 1; i >= 0 && !errorp(machine); --i) {
+        machine = cons(registers[i], machine);
+    }
+    return machine;
 }
 
-cell sequence_exp(cell seq) {
-    if (nullp(seq))
-        return seq;
-    else if (last_expp(seq))
-        return first_exp(seq);
-    else
-        return mkbegin(seq);
+static void ec_resume(ec_machine *m, cell machine) {
+    cell registers[EC_SUSPENDED];
+    for (int i = 0; i < EC_SUSPENDED; ++i, machine = cdr(machine)) registers[i] = car(machine);
+    m->exp = registers[0];
+    m->env = registers[1];
+    m->val = registers[2];
+    m->proc = registers[3];
+    m->argl = registers[4];
+    m->unev = registers[5];
+    m->cont = (enum ec_label) fixnum(registers[6]);
+    m->label = (enum ec_label) fixnum(registers[7]);
+    m->depth = (size_t) fixnum(registers[8]);
+    m->stack = machine;
 }
 
-cell expand_clauses(cell clauses) {
-    if (nullp(clauses)) {
-        return nil;
+/*
+ * Give the machine `steps' more steps, then its result or, if it has not finished, the suspended machine
+ */
+static cell ec_continue(ec_machine *m, size_t steps, lisp_eval_state *state) {
+    m->budget = steps;
+    cell result = ec_run(m);
+    if (result != NULL) {
+        state->steps += steps - m->budget;
+        return result;
     }
-    cell first = car(clauses);
-    cell rest = cdr(clauses);
-
-    if (cond_elsep(first)) {
-       if (nullp(rest)) {
-           return sequence_exp(cond_actions(first));
-       } else {
-           return mkerror("ELSE clause isn't last cond-if");
-       }
-    } else {
-        return mkif(cond_predicate(first),
-                sequence_exp(cond_actions(first)),
-                expand_clauses(rest));
+    state->steps += steps;
+    cell machine = ec_suspend(m);
+    if (errorp(machine)) return machine;
+    state->machine = machine;
+    if (!lisp_gc_root(&state->machine)) {
+        state->machine = nil;
+        return mkerror("No GC root left to suspend in -- EVAL");
     }
+    return state->machine;
 }
 
+cell lisp_eval_with_budget(cell exp, cell env, size_t steps, lisp_eval_state *state) {
+    ec_machine m = { exp, env, nil, nil, nil, nil, EC_DONE, nil, 0, EC_DISPATCH, steps };
+    state->machine = nil;
+    state->steps = 0;
+    return ec_continue(&m, steps, state);
+}
+
+cell lisp_eval_resume(lisp_eval_state *state, size_t steps) {
+    ec_machine m;
+    if (!lisp_suspendedp(state)) return mkerror("No suspended evaluation to resume -- EVAL");
+    ec_resume(&m, state->machine);
+    lisp_eval_abandon(state);
+    return ec_continue(&m, steps, state);
+}
+
+void lisp_eval_abandon(lisp_eval_state *state) {
+    if (!lisp_suspendedp(state)) return;
+    lisp_gc_unroot(&state->machine);
+    state->machine = nil;
+}
 
 /**
  * ----------------------------------------------------------------------
@@ -455,14 +3669,14 @@ int lisp_length(cell exp) {
  * Find the last element of a list
  */
 cell last_aux(cell exp) {
-    if (nullp(exp->rest)) return exp;
-    return last_aux(exp->rest);
+    if (nullp(cdr(exp))) return exp;
+    return last_aux(cdr(exp));
 }
 cell last(cell list) {
     if (nullp(list)) { return nil; }        // No list
     if (!listp(list)) { return nil; }       // Not a list
-    if (nullp(list->adata)) { return nil; } // Empty list
-    return last_aux(list->adata);
+    if (nullp(car(list))) { return nil; }   // Empty list
+    return last_aux(car(list));
 }
 
 cell nth(cell exp, int n) {
@@ -479,18 +3693,22 @@ cell append(cell head, cell other) {
     if (nullp(head))
         list = cons(other, nil);
     else
-        last(list)->rest = other;
+        setcdrb(last(list), other);
     return list;
 }
 
+#ifdef WITH_TAGGED_IMMEDIATES
+bool nullp(cell exp) { return exp == nil; }
+#else
 bool nullp(cell exp) { return lisp_equals(exp, nil); }
+#endif
 bool listp(cell exp) {
     if (nullp(exp)) return true;
-    return (exp->type == CONS);
+    return pairp(exp);
 }
 
 bool numberp(cell exp) {
-    switch (exp->type) {
+    switch (lisp_typeof(exp)) {
         case FIXNUM:
         case FLOAT:
             return true;
@@ -500,7 +3718,7 @@ bool numberp(cell exp) {
 }
 
 bool symbolp(cell exp) {
-    return (exp->type == SYM);
+    return (lisp_typeof(exp) == SYM);
 }
 
 /**
@@ -509,13 +3727,16 @@ bool symbolp(cell exp) {
 bool lisp_eq(cell lhs, any rhs) {
     bool result = false;
 
-    switch (lhs->type) {
+    switch (lisp_typeof(lhs)) {
         case NIL:
-            result = ((lhs -> data == nil) && (rhs == nil || rhs == NULL));
+            result = ((car(lhs) == nil) && (rhs == nil || rhs == NULL));
             break;
         case FIXNUM:
             result = ( fixnum(lhs) == *((lisp_fixnum *)rhs) );
             break;
+        case CHAR:
+            result = ( character(lhs) == *((lisp_char *)rhs) );
+            break;
         case ERROR:
         case STRING:
         case SYM:
@@ -528,6 +3749,12 @@ bool lisp_eq(cell lhs, any rhs) {
 #endif
         case CONS:
         case FN:
+        case LEXICAL:
+        case FRAME:
+        case NODE:
+        case CODE:
+        case FREE:
+        case MOVED:
             result = (lhs == rhs);
     }
     return result;
@@ -542,6 +3769,7 @@ cell mklist_from_array(size_t l, cell arr[]) {
     for(size_t i=0; i<l; i++) {
         exp = arr[i];
         c = cons(exp, nil);
+        if (errorp(c)) break;
         if (first) {
             first = false;
             list = last = c;
@@ -550,6 +3778,7 @@ cell mklist_from_array(size_t l, cell arr[]) {
             last = c;
         }
     }
+    if (errorp(c)) return c;
     setcdrb(last, nil);
     return list;
 }
@@ -566,6 +3795,7 @@ cell mklist(int l, ...) {
     for(; l>0; l--) {
         exp = va_arg(ap, cell);
         c = cons(exp, nil);
+        if (errorp(c)) break;
         if (first) {
             first = false;
             list = last = c;
@@ -574,8 +3804,9 @@ cell mklist(int l, ...) {
             last = c;
         }
     }
-    setcdrb(last, nil);
     va_end(ap);
+    if (errorp(c)) return c;
+    setcdrb(last, nil);
     return list;
 }
 
@@ -586,15 +3817,18 @@ bool lisp_equals(cell lhs, cell rhs) {
     if (lhs == rhs) return true;
 
     bool result = false;
-    if (lhs->type != rhs->type) return false;
+    if (lisp_typeof(lhs) != lisp_typeof(rhs)) return false;
 
-    switch (lhs->type) {
+    switch (lisp_typeof(lhs)) {
         case NIL:
-            result = (rhs -> type == NIL);
+            result = true;
             break;
         case FIXNUM:
             result = ( fixnum(lhs) == fixnum(rhs) );
             break;
+        case CHAR:
+            result = ( character(lhs) == character(rhs) );
+            break;
 #ifdef WITH_FLOATING_POINT
         case FLOAT:
             result = ( floater(lhs) == floater(rhs) );
@@ -602,11 +3836,17 @@ bool lisp_equals(cell lhs, cell rhs) {
 #endif
         case STRING:
         case ERROR:
-        case SYM:
             result = ( strcmp(symbol(lhs), symbol(rhs)) == 0 );
             break;
+        case SYM:       // Interned, equal symbols are the same cell
         case CONS:
         case FN:
+        case LEXICAL:
+        case FRAME:
+        case NODE:
+        case CODE:
+        case FREE:
+        case MOVED:
             result = ( lhs == rhs );
     }
     return result;
@@ -620,9 +3860,27 @@ bool lisp_equals(cell lhs, cell rhs) {
 
 
 cell primary_alloc(enum lisp_type type, size_t length, any data, cell rest) {
-    cell result = calloc(1, sizeof(lisp_cell));
+    cell result = NULL;
+    if (!quota_charge(1, sizeof(lisp_cell) + (payload_typep(type) || type == FRAME ? length : 0)))
+        return &oom_cell;
+    if (region_active && type != SYM && type != NODE && type != CODE) {
+        result = arena_alloc(type, length);
+        if (result == NULL && quota_active) {
+            quota_exceeded = true;
+            return &oom_cell;
+        }
+    } else if (nursery_typep(type))
+        result = nursery_alloc();
+    if (result == NULL) result = cell_alloc();
+    if (result == NULL) return &oom_cell;
     result->type = type;
-//    result->marked_for_gc = false;
+#ifdef DEBUG
+    result->name = NULL;
+#endif
+    result->marked = gc_black;  // Allocated black, see incremental collection
+    result->remembered = false;
+    result->form = FORM_NONE;
+    result->addressed = false;
 //    result->length = length;
     result->data = data;
     result->rest = rest;
@@ -635,6 +3893,8 @@ cell lisp_alloc(enum lisp_type type, size_t length, any data, cell rest) {
     any ptr;
     size_t len;
 
+    if (result == &oom_cell) return result;
+
     switch (type) {
         case FN:
             result->data = data;
@@ -646,15 +3906,21 @@ cell lisp_alloc(enum lisp_type type, size_t length, any data, cell rest) {
                 switch (type) {
                     case FIXNUM:
                     case FLOAT:
-                        ptr = malloc(length);
-                        memcpy(ptr, data, length);
-                        result->data = ptr;
+                    case CHAR:
+                    case LEXICAL:
+                        // Numbers are held inline in the cell
+                        memcpy(&result->data, data, length);
                         break;
                     case STRING:
                     case SYM:
                     case ERROR: {
                         len = strlen(data) + 1;
-                        ptr = malloc(len);
+                        // An arena cell is followed by room for its payload
+                        ptr = lisp_arenap(result) ? (any) (result + 1) : mem_alloc(len);
+                        if (ptr == NULL) {
+                            cell_release(result);   // The payload never made it
+                            return &oom_cell;
+                        }
                         memcpy(ptr, data, len);
                         result->data = ptr;
                         break;
@@ -670,51 +3936,117 @@ cell lisp_alloc(enum lisp_type type, size_t length, any data, cell rest) {
     if (rest == NULL)
         result->rest = nil;
 
-    if(rest != all_objects || all_objects == nil)
-        all_objects = cons(result, all_objects);
+    // Initialising stores need the write barrier as much as setcarb/setcdrb: the new cell is black, and
+    // once the nursery or the arena is full it is allocated old, possibly pointing at younger cells
+    if (type == CONS) lisp_write_barrier(result, result->adata);
+    lisp_write_barrier(result, result->rest);
 
     return result;
 }
 
-bool destroy_aux(cell exp, cell objects, cell last) {
-    if (nullp(objects)) return false;  // Searched past end of list
-    if(exp == nil || exp == all_objects) return false;
+/*
+ * The symbol called `name', made the first time the name is seen. A symbol found in the table while a
+ * collection is running is shaded, it may have been white and is about to be referred to again.
+ */
+cell lisp_intern(const char *name) {
+    symbol_entry *entry;
+#ifdef WITH_TAGGED_IMMEDIATES
+    if (strcmp(name, T) == 0) return lisp_true;
+#endif
+    HASH_FIND_STR(symbols, name, entry);
+    if (entry != NULL) {
+        if (gc_phase == GC_MARK)
+            gc_mark(entry->sym);
+        else if (gc_phase == GC_SWEEP)
+            entry->sym->marked = gc_black;
+        return entry->sym;
+    }
 
-    // Is the first element of `objects' the cell we're looking for?
-    if (car(objects) == exp) {
-        switch (exp->type) {
-            case NIL:
-            case CONS:
-            case FN:
-                break;
-            default:
-                free(exp->data);
-                break;
-        }
-        free(exp);                  // Free the thing we're looking for
+    cell sym = lisp_alloc(SYM, string_size(strlen(name)), (any) name, nil);
+    if (errorp(sym)) return sym;
+    return intern_add(sym);
+}
 
-        if (objects == last) {
-            all_objects = cdr(objects); // Change the head of the heap to be the next item
-            free(objects);              // Free the previous head of the heap
-            return false;
-        } else {
-            return true;
-        }
+/*
+ * Destroy a single object in constant time, destroying it twice is harmless
+ */
+void lisp_destroy(cell exp) {
+    // Cannot cleanup specials here, but can cleanup nil objects
+    if (exp == nil || immediatep(exp) || exp == &oom_cell || exp->type == FREE) return;
+    if (lisp_arenap(exp)) {
+        cell_release(exp);     // The payload is in the arena too
+        return;
     }
 
-    if (destroy_aux(exp, cdr(objects), objects)) {
-        // It was destroyed, now slice it from the heap
-        setcdrb(objects, cdr(cdr(objects)));  // Set this object to the next next
-        free(cdr(objects));                  // Release the next
+    switch (exp->type) {
+        case NIL:
+        case CONS:
+        case FIXNUM:
+        case FLOAT:
+        case CHAR:
+        case FN:
+        case LEXICAL:
+            break;
+        case SYM:
+            intern_forget(exp);
+            mem_free(exp->data);
+            break;
+        case FRAME:
+            frame_free(frame_vector(exp));
+            break;
+        case NODE:
+            node_free(exp->data);
+            break;
+        default:
+            mem_free(exp->data);
+            break;
     }
+    cell_release(exp);
 }
 
-void lisp_destroy(cell exp, cell objects) {
-    // Cannot cleanup specials here, but can cleanup nil objects
-    if(exp == nil || exp == all_objects) return;
-    if (nullp(objects)) return;
+#define destroyablep(A) (!immediatep(A) && (A)->type != FREE && (A)->type != SYM && (A)->type != NODE &&  \
+                         (A)->type != CODE && (A)->type != FRAME &&                                         \
+                         (A) != nil && (A) != &oom_cell && (A) != the_empty_environment && (A) != global_env)
+
+/*
+ * Destroy `exp' and everything reachable from it through car and cdr in one linear pass, without
+ * recursion. The walk stops at frames and environments, which closures share, and of a compound
+ * procedure only destroys its own list: the parameters and body are those of the lambda expression it
+ * was made from. It also stops at symbols, which are shared by everything that names them and left to
+ * the collector, as are analyzed and compiled bodies and the inline cache of a variable reference.
+ * Nothing else in the structure may still be referenced from elsewhere.
+ */
+void lisp_destroy_list(cell exp) {
+    cell pending = NULL;    // Conses whose car is still to be destroyed, linked through `rest'
+
+    for (;;) {
+        while (destroyablep(exp)) {
+            cell next = exp->type == LEXICAL ? nil : exp->rest;
+            if (compound_procp(exp)) {
+                // (procedure parameters body env), the elements all belong to someone else
+                for (int i = 0; i < 4 && pairp(exp); ++i) {
+                    next = exp->rest;
+                    cell_release(exp);
+                    exp = next;
+                }
+                next = nil;
+            } else if (exp->type == CONS) {
+                // Kept until its car is done, FREE stops shared or circular structure being visited twice
+                exp->type = FREE;
+                exp->rest = pending;
+                pending = exp;
+            } else {
+                lisp_destroy(exp);
+            }
+            exp = next;
+        }
+        if (pending == NULL) return;
 
-    destroy_aux(exp, objects, objects);
+        cell done = pending;
+        pending = done->rest;
+        exp = done->adata;
+        cell_release(done);
+    }
 }
 
 cell lisp_read_list(const char **buf) {
@@ -764,11 +4096,13 @@ cell lisp_read_list(const char **buf) {
                 break;
         }
 
+        if (errorp(tmp)) return tmp;
         tmp = cons(tmp, nil);
+        if (errorp(tmp)) return tmp;
         if (nullp(list)) {
             last = list = tmp;
         } else {
-            last->rest = tmp;
+            setcdrb(last, tmp);
             last = tmp;
         }
     }
@@ -819,13 +4153,26 @@ cell lisp_read_symbol(const char **buf) {
 
 cell lisp_read_string(const char **buf) {
     cell result;
-    lisp_char *data = calloc(MAXLEN, sizeof(lisp_char));
+    lisp_char *data, *grown;
     int fact = 1;
     int i = 0;
     bool escaped = false;
 
+    if (!quota_charge(0, MAXLEN * sizeof(lisp_char))) return &oom_cell;
+    if ((data = mem_alloc(MAXLEN * sizeof(lisp_char))) == NULL) return &oom_cell;
     while(**buf) {
-        if (i >= MAXLEN) data = realloc(data, ++fact * MAXLEN * sizeof(lisp_char));
+        if (i >= fact * MAXLEN - 1) {
+            if (!quota_charge(0, MAXLEN * sizeof(lisp_char))) {
+                mem_free(data);
+                return &oom_cell;
+            }
+            grown = mem_realloc(data, ++fact * MAXLEN * sizeof(lisp_char));
+            if (grown == NULL) {
+                mem_free(data);
+                return &oom_cell;
+            }
+            data = grown;
+        }
         escaped = (**buf == '\\');
 
         if (**buf == '"' && !escaped) {
@@ -841,8 +4188,9 @@ cell lisp_read_string(const char **buf) {
         ++i;
     }
 
+    data[i] = 0;
     result = mkstring(data);
-    free(data);
+    mem_free(data);
     return result;
 }
 
@@ -878,15 +4226,49 @@ cell lisp_read(const char **buf) {
     return nil;
 }
 
+#ifdef WITH_STATIC_HEAP
+void lisp_init(void *buffer, size_t size) {
+    mem_init(buffer, size);
+    nursery_init(size);
+#else
 void lisp_init() {
+    nursery_init(SIZE_MAX);
+#endif
+    oom_cell.type = ERROR;
+    oom_cell.string = (lisp_char *) ERR_OUTOFMEMORY;
+    oom_cell.rest = NULL;
+
     // Must be manually cleaned up
+#ifdef WITH_TAGGED_IMMEDIATES
+    nil          = IMMEDIATE_NIL;
+    lisp_true    = IMMEDIATE_T;
+#else
     nil          = primary_alloc(NIL, lisp_sizeof(CONS), NULL, NULL);
     setcarb(nil, nil); setcdrb(nil, nil);
-    all_objects  = primary_alloc(CONS, lisp_sizeof(CONS), nil, nil);
     lisp_true    = mksym(T);
-    lisp_if      = mksym(IF);
-    lisp_begin   = mksym(BEGIN);
-    procedure    = mksym(PROC);
+#endif
+    oom_cell.rest = nil;
+    lisp_quote     = mksym(QUOTE);
+    lisp_setb      = mksym(SETB);
+    lisp_define    = mksym(DEFINE);
+    lisp_lambda    = mksym(LAMBDA);
+    lisp_if        = mksym(IF);
+    lisp_begin     = mksym(BEGIN);
+    lisp_cond      = mksym(COND);
+    lisp_else      = mksym(ELSE);
+    lisp_false     = mksym(FALSE);
+    procedure      = mksym(PROC);
+    lisp_primitive = mksym(PRIMITIVE);
+    lisp_define_macro = mksym(DEFINE_MACRO);
+    lisp_macro     = mksym(MACRO);
+    lisp_quote->form  = FORM_QUOTE;
+    lisp_setb->form   = FORM_SETB;
+    lisp_define->form = FORM_DEFINE;
+    lisp_if->form     = FORM_IF;
+    lisp_lambda->form = FORM_LAMBDA;
+    lisp_begin->form  = FORM_BEGIN;
+    lisp_cond->form   = FORM_COND;
+    lisp_define_macro->form = FORM_DEFINE_MACRO;
 
     // Cleanup all will get these
     the_empty_environment = cons(nil, nil);
@@ -894,7 +4276,6 @@ void lisp_init() {
 
 #ifdef DEBUG
     nil->name = "NIL";
-    all_objects->name = "ALL_OBJECTS";
     all_symbols->name = "ALL_SYMBOLS";
     env->name = "ENV";
 #endif
@@ -903,9 +4284,16 @@ void lisp_init() {
 void lisp_cleanup() {
     // Calling lisp_free with cleanup all set to true
     lisp_free(true);
-    // These special symbols must be freed explicitly
-    free(all_objects);
-    free(nil);
+    // nil is spared by lisp_free, it goes back with the pages
+    heap_release();
+    nursery_release();
+    intern_release();
+    frame_pool_release();
+    vm_release();
+    mem_free(lisp_arena);
+    lisp_arena = lisp_arena_end = NULL;
+    gc_reset();
+    gc_root_count = 0;
 }
 
 size_t lisp_sizeof(enum lisp_type type) {
@@ -928,17 +4316,46 @@ size_t lisp_sizeof(enum lisp_type type) {
         case SYM:
             result = sizeof(lisp_char);
             break;
+        case CHAR:
+            result = sizeof(lisp_char);
+            break;
         case NIL:
             result = 0;
             break;
+        case FRAME:
+            result = sizeof(lisp_frame);
+            break;
+        case NODE:
+            result = sizeof(lisp_node);
+            break;
+        case CODE:
+            result = sizeof(lisp_code);
+            break;
         case FN:
+        case LEXICAL:
+        case FREE:
+        case MOVED:
             result = 0;
             break;
     }
     return result;
 }
 
-cell mkfixnum(lisp_fixnum A)        { return lisp_alloc(FIXNUM, sizeof(lisp_fixnum), &A, nil); }
+cell mkfixnum(lisp_fixnum A) {
+#ifdef WITH_TAGGED_IMMEDIATES
+    if (A >= FIXNUM_IMMEDIATE_MIN && A <= FIXNUM_IMMEDIATE_MAX) return mkfixnum_immediate(A);
+#endif
+    return lisp_alloc(FIXNUM, sizeof(lisp_fixnum), &A, nil);
+}
+
+cell mkchar(lisp_char c) {
+#ifdef WITH_TAGGED_IMMEDIATES
+    return mkchar_immediate(c);
+#else
+    return lisp_alloc(CHAR, sizeof(lisp_char), &c, nil);
+#endif
+}
+
 #ifdef WITH_FLOATING_POINT
 cell mkfloat(lisp_float f) { return lisp_alloc(FLOAT, sizeof(lisp_float), &f, nil); }
 #endif
@@ -998,10 +4415,13 @@ void lisp_print_list_aux(cell i, int depth) {
             printf(" ");
         }
         first = false;
-        switch(e->type) {
+        switch(lisp_typeof(e)) {
             case NIL:
                 printf("NIL");
                 break;
+            case CHAR:
+                printf("<#CHAR: %c>", character(e));
+                break;
             case CONS:
                 if (depth >0)
                     printf("<#LIST: ");
@@ -1022,12 +4442,30 @@ void lisp_print_list_aux(cell i, int depth) {
             case SYM:
                 printf("<#SYM: %s>", symbol(e));
                 break;
+            case LEXICAL:
+                printf("<#LEXICAL: %s %d %d>", symbol(lexical_name(e)), (int) lexical_depth(e), (int) lexical_slot(e));
+                break;
             case ERROR:
                 printf("<#ERROR: \"%s\">", e->string);
                 break;
             case FN:
                 printf("<#FN: %li>", (long)e);
                 break;
+            case FRAME:
+                printf("<#FRAME: %d>", (int) frame_vector(e)->count);
+                break;
+            case NODE:
+                printf("<#NODE: %li>", (long)e);
+                break;
+            case CODE:
+                printf("<#CODE: %li>", (long)e);
+                break;
+            case FREE:
+                printf("<#FREE>");
+                break;
+            case MOVED:
+                printf("<#MOVED: %li>", (long)e->adata);
+                break;
         }
         ptr = rest(ptr);
     }
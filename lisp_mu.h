@@ -2,6 +2,7 @@
 #define __LISP_MU__
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 // Generally on micro controllers, using doubles/floats will bloat the codebase, comment this to
@@ -11,6 +12,25 @@
 
 #define MAXLEN 256  // max length of strings and symbols
 
+// Cells are carved from pages of LISP_PAGE_CELLS cells. Uncomment WITH_STATIC_HEAP to take all memory, cells
+// and strings alike, from a block passed to lisp_init instead of malloc. Running out of it is an ERROR cell.
+//#define WITH_STATIC_HEAP
+#define LISP_PAGE_CELLS     256
+#define LISP_GC_ROOTS       32      // C variables that can be registered with lisp_gc_root
+#define LISP_MARK_STACK     128     // Depth of the mark stack before marking falls back to rescanning the heap
+#define LISP_NURSERY_CELLS  1024    // Young generation, short lived cells are bump allocated here
+#define LISP_REMEMBERED     256     // Old cells pointing into the nursery before a minor collection scans the heap
+#define LISP_REGION_BYTES   (64 * 1024) // Arena backing lisp_region_begin/lisp_region_end
+#define LISP_EC_DEPTH       (16 * 1024) // Entries the explicit control evaluator may save before an ERROR
+
+// Uncomment to encode small fixnums, characters, nil and T in the low bits of a cell pointer instead of
+// allocating a cell for them, see "Tagged immediates" below
+//#define WITH_TAGGED_IMMEDIATES
+
+// The bytecode machine dispatches with computed gotos where the compiler has them (GCC and clang), uncomment
+// to use the portable switch instead
+//#define WITH_SWITCH_DISPATCH
+
 static char *const  T          = "T";
 static char *const  QUOTE      = "quote";
 static char *const  SETB       = "set!";
@@ -23,6 +43,8 @@ static char *const  ELSE       = "else";
 static char *const  FALSE      = "false";
 static char *const  PROC       = "procedure";
 static char *const  PRIMITIVE  = "primitive";
+static char *const  DEFINE_MACRO = "define-macro";
+static char *const  MACRO      = "macro";
 
 // Here you can affect the underlying data types used in the lisp system
 #ifdef WITH_FLOATING_POINT
@@ -32,7 +54,19 @@ typedef long int        lisp_fixnum;
 typedef char            lisp_char;
 typedef void            *any;
 enum lisp_type {
-    NIL, CONS, FIXNUM, FLOAT, STRING, SYM, ERROR, FN
+    NIL, CONS, FIXNUM, FLOAT, STRING, SYM, ERROR, FN, CHAR,
+    LEXICAL,    // A variable reference resolved by lexical addressing, `rest' is the symbol or for a free
+                // variable its inline cache, (symbol . value)
+    FRAME,      // The frame of a procedure call, `data' is its lisp_frame and `rest' the enclosing environment
+    NODE,       // An analyzed expression, `data' is its lisp_node, see lisp_analyze
+    CODE,       // Compiled bytecode, `data' is its lisp_code, see lisp_compile
+    FREE,   // A cell on the allocator's free list, never seen by lisp code
+    MOVED   // A nursery cell promoted by a minor collection, `adata' is the new cell
+};
+
+// The special forms, a symbol naming one carries its form so that eval can dispatch on it directly
+enum lisp_form {
+    FORM_NONE, FORM_QUOTE, FORM_SETB, FORM_DEFINE, FORM_IF, FORM_LAMBDA, FORM_BEGIN, FORM_COND, FORM_DEFINE_MACRO
 };
 
 typedef struct cell {
@@ -40,36 +74,150 @@ typedef struct cell {
 #ifdef DEBUG
     char * name;
 #endif
+    bool marked;                // Compared with the collector's mark sense, which flips every cycle
+    bool remembered;            // An old cell in the remembered set, it points into the nursery
+    unsigned char form;         // enum lisp_form of a special form's symbol, FORM_NONE for any other cell
+    bool addressed;             // A lambda expression whose body has been lexically addressed
     struct cell *rest;
-//    bool marked_for_gc;
 //    size_t length;
     union {
         any              data;
         struct cell     *adata;
-        lisp_fixnum     *fixnum;
+        lisp_fixnum      fixnum;
+        lisp_char        character;
         lisp_char       *string;
         lisp_char       *symbol;
         struct cell *   (*fn)(struct cell *parms);
+        struct {
+            int16_t      depth;     // Frames to go out
+            int16_t      slot;      // Position in that frame, or LEXICAL_FREE
+            uint32_t     stamp;     // Version of the globals when a free variable's value was cached
+        }                address;
 #ifdef WITH_FLOATING_POINT
-        lisp_float      *floater;
+        lisp_float       floater;
 #endif
     };
 } lisp_cell, *cell;
 
-cell nil, all_objects, the_empty_environment, global_env, lisp_true, lisp_if,
+// The values of a FRAME, one slot per variable
+typedef struct lisp_frame {
+    union {
+        struct cell       *names;   // Variable of each slot, the procedure's parameter list until a define adds one
+        struct lisp_frame *next;    // A recycled payload, see Frame vectors
+    };
+    size_t                 size;    // Slots allocated
+    size_t                 count;   // Slots in use
+    struct cell           *slots[];
+} lisp_frame;
+
+cell nil, the_empty_environment, global_env, lisp_true, lisp_if,
         lisp_begin, procedure;
+// The interned symbols naming the special forms, see tagged_listp
+cell lisp_quote, lisp_setb, lisp_define, lisp_lambda, lisp_cond, lisp_else, lisp_false, lisp_primitive,
+        lisp_define_macro, lisp_macro;
+cell lisp_nursery, lisp_nursery_end;   // Bounds of the young generation
+char *lisp_arena, *lisp_arena_end;      // Bounds of the region arena, empty outside a region
+bool lisp_gc_marking;   // An incremental collection is marking, stores must go through the write barrier
+
+void lisp_gc_shade(cell c);
+void lisp_gc_remember(cell c);
 
 #define N_ELEMENTS(array) (sizeof(array)/sizeof(cell))
 
-// Accessors
-#define fixnum(A)       *((A)->fixnum)
+/*
+ * Tagged immediates
+ * Cells are at least 4 byte aligned, so a pointer with either of its low two bits set is not a pointer
+ * at all but a value in its own right:
+ *   ....01  fixnum, shifted left by 2
+ *   ..0010  constant (nil, T), shifted left by 4
+ *   ..0110  character, shifted left by 4
+ * Immediates are never allocated or destroyed. Fixnums too large for the tag are boxed as usual.
+ */
+#ifdef WITH_TAGGED_IMMEDIATES
+
+#define TAG_MASK            3
+#define TAG_FIXNUM          1
+#define TAG_SUBMASK         15
+#define TAG_CONST           2
+#define TAG_CHAR            6
+#define IMMEDIATE_NIL       ((cell) (0 << 4 | TAG_CONST))
+#define IMMEDIATE_T         ((cell) (1 << 4 | TAG_CONST))
+#define FIXNUM_IMMEDIATE_MAX    ((lisp_fixnum) (INTPTR_MAX >> 2))
+#define FIXNUM_IMMEDIATE_MIN    ((lisp_fixnum) (INTPTR_MIN >> 2))
+
+#define immediatep(A)           (((uintptr_t)(A) & TAG_MASK) != 0)
+#define fixnum_immediatep(A)    (((uintptr_t)(A) & TAG_MASK) == TAG_FIXNUM)
+#define char_immediatep(A)      (((uintptr_t)(A) & TAG_SUBMASK) == TAG_CHAR)
+#define mkfixnum_immediate(N)   ((cell) ((uintptr_t)(N) << 2 | TAG_FIXNUM))
+#define mkchar_immediate(C)     ((cell) ((uintptr_t)(unsigned char)(C) << 4 | TAG_CHAR))
+
+static inline enum lisp_type lisp_typeof(cell a) {
+    if (!immediatep(a))         return a->type;
+    if (fixnum_immediatep(a))   return FIXNUM;
+    if (char_immediatep(a))     return CHAR;
+    return a == IMMEDIATE_NIL ? NIL : SYM;
+}
+// Any other immediate, the car of nil say, reads as 0 instead of being dereferenced
+static inline lisp_fixnum lisp_fixnum_value(cell a) {
+    if (!immediatep(a))         return a->fixnum;
+    return fixnum_immediatep(a) ? (lisp_fixnum) ((intptr_t)a >> 2) : 0;
+}
+static inline lisp_char lisp_char_value(cell a) {
+    if (!immediatep(a))         return a->character;
+    return char_immediatep(a) ? (lisp_char) ((uintptr_t)a >> 4) : 0;
+}
+static inline lisp_char *lisp_symbol_name(cell a) {
+    return a == IMMEDIATE_T ? T : a->symbol;
+}
+static inline cell lisp_car(cell a) { return immediatep(a) ? IMMEDIATE_NIL : a->adata; }
+static inline cell lisp_cdr(cell a) { return immediatep(a) ? IMMEDIATE_NIL : a->rest; }
+
+#define fixnum(A)       lisp_fixnum_value(A)
+#define character(A)    lisp_char_value(A)
+#define symbol(A)       lisp_symbol_name(A)
+#define car(A)          lisp_car(A)
+#define cdr(A)          lisp_cdr(A)
+
+#else
+
+#define immediatep(A)   false
+#define lisp_typeof(A)  ((A)->type)
+#define fixnum(A)       ((A)->fixnum)
+#define character(A)    ((A)->character)
 #define symbol(A)       ((A)->symbol)
 #define car(A)          ((A)->adata)
-#define first(A)        car(A)
-#define setcarb(A,B)     ((A)->adata = (B))
 #define cdr(A)          ((A)->rest)
+
+#endif // WITH_TAGGED_IMMEDIATES
+
+static inline bool lisp_youngp(cell a) {
+    return !immediatep(a) && a >= lisp_nursery && a < lisp_nursery_end;
+}
+static inline bool lisp_arenap(cell a) {
+    return !immediatep(a) && (char *) a >= lisp_arena && (char *) a < lisp_arena_end;
+}
+
+/*
+ * Write barrier, while the collector is marking any value stored into a cell is shaded grey so an
+ * already scanned (black) cell can never hide a white one from the collector. An old cell that is made
+ * to point at a young one, or a cell outside the region arena at one inside, is remembered; it is a root
+ * of the next minor collection or of the evacuation at the end of the region.
+ */
+static inline cell lisp_write_barrier(cell obj, cell val) {
+    if (lisp_gc_marking) lisp_gc_shade(val);
+    if (!obj->remembered &&
+        ((lisp_youngp(val) && !lisp_youngp(obj)) || (lisp_arenap(val) && !lisp_arenap(obj))))
+        lisp_gc_remember(obj);
+    return val;
+}
+static inline cell lisp_setcar(cell a, cell b) { return a->adata = lisp_write_barrier(a, b); }
+static inline cell lisp_setcdr(cell a, cell b) { return a->rest = lisp_write_barrier(a, b); }
+
+// Accessors
+#define first(A)        car(A)
+#define setcarb(A,B)     lisp_setcar(A, B)
 #define rest(A)         cdr(A)
-#define setcdrb(A,B)     ((A)->rest = (B))
+#define setcdrb(A,B)     lisp_setcdr(A, B)
 #define second(A)       car(cdr(A))
 #define third(A)        car(cdr(cdr(A)))
 #define cadr(A)         car(cdr(A))
@@ -83,15 +231,16 @@ cell nil, all_objects, the_empty_environment, global_env, lisp_true, lisp_if,
 #define cdadr(A)        cdr(car(cdr(A)))
 #define cdddr(A)        cdr(cdr(cdr(A)))
 #define cadddr(A)       car(cdr(cdr(cdr(A))))
-#define pairp(A)        (A->type == CONS)
-#define errorp(A)       (A->type == ERROR)
-#define tagged_listp(A, B)  (pairp(A) && lisp_eq(car(A), B))
+#define pairp(A)        (lisp_typeof(A) == CONS)
+#define errorp(A)       (lisp_typeof(A) == ERROR)
+#define tagged_listp(A, B)  (pairp(A) && car(A) == (B))     // B is an interned symbol
+#define special_form(A)     (immediatep(A) ? FORM_NONE : (enum lisp_form) (A)->form)
 
 
 // Special handling of doubles
 #ifdef WITH_FLOATING_POINT
 
-#define     floater(A)      *((A)->floater)
+#define     floater(A)      ((A)->floater)
 cell        mkfloat(lisp_float f);
 
 #endif  //WITH_FLOATING_POINT
@@ -99,7 +248,7 @@ cell        mkfloat(lisp_float f);
 // Evaluation subsystem
 // See: https://mitpress.mit.edu/sicp/full-text/book/book-Z-H-26.html
 cell eval(cell exp, cell env);
-cell apply(cell procedure, cell arguments);
+cell apply(cell proc, cell arguments);
 bool self_evaluatingp(cell exp);
 bool falsep(cell exp);
 bool truep(cell exp);
@@ -110,39 +259,49 @@ cell eval_definition(cell exp, cell env);
 cell mklist(int l, ...);
 cell mklist_from_array(size_t l, cell arr[]);
 
+// The C stack eval has used since lisp_stack_reset, in bytes
+size_t lisp_stack_high_water();
+void lisp_stack_reset();
+
 
 // Environment
+// An environment is a chain of frames ending in the_empty_environment. The frame of a procedure call is
+// a FRAME cell holding its values in a vector and linked to the enclosing environment by `rest', any
+// other frame, global_env's included, is a pair of lists consed onto the chain.
+#define framep(A)                   (lisp_typeof(A) == FRAME)
+#define frame_vector(A)             ((lisp_frame *) (A)->data)
+#define frame_slot(A, I)            (frame_vector(A)->slots[I])
 #define enclosing_environment(A)    cdr(A)
-#define first_frame(A)              car(A)
+#define first_frame(A)              (framep(A) ? (A) : car(A))
 #define mkframe(A,B)                cons(A,B)
-#define frame_variables(A)          car(A)
+#define frame_variables(A)          car(A)      // Of a list frame
 #define frame_values(A)             cdr(A)
 cell add_binding_to_frameb(cell var, cell val, cell frame);
 cell extend_environment(cell vars, cell vals, cell base_env);
 
 // Quotes
-#define quotedp(A)                  tagged_listp(A, QUOTE)
+#define quotedp(A)                  tagged_listp(A, lisp_quote)
 
 // Procedure
 cell mkprocedure(cell parameters, cell body, cell env);
-#define compound_procp(A)           tagged_listp(A, PROC)
+#define compound_procp(A)           tagged_listp(A, procedure)
 #define procedure_parameters(A)     cadr(A)
 #define procedure_body(A)           caddr(A)
 #define procedure_environment(A)    cadddr(A)
 cell list_of_values(cell exp, cell env);
 
 // Primitives
-#define primitive_procp(A)          tagged_listp(A, PRIMITIVE)
+#define primitive_procp(A)          tagged_listp(A, lisp_primitive)
 #define primitive_fn(A)             (caddr(A)->fn)
 #define primitive_name(A)           (cadr(A))
 #define primitive_call(FN, PARAMS)  primitive_fn(FN)(PARAMS)
 // FN's are C functions and should be created as primitives
-#define mkfn(SYM, FUN)  mklist(3, mksym(PRIMITIVE), mksym(SYM), lisp_alloc(FN, 0, FUN, nil))
+#define mkfn(SYM, FUN)  mklist(3, lisp_primitive, mksym(SYM), lisp_alloc(FN, 0, FUN, nil))
 cell primitive_procedure_objects();
 cell primitive_procedure_names();
 
 // Assignment variables
-#define assignmentp(A)              tagged_listp((A), SETB)
+#define assignmentp(A)              tagged_listp((A), lisp_setb)
 #define assignment_variable(A)      cadr(A)
 #define assignment_value(A)         caddr(A)
 bool variablep(cell exp);
@@ -152,25 +311,103 @@ cell def_variable_aux(cell vars,cell vals, cell var, cell val, cell frame);
 cell define_variableb(cell var, cell val, cell env);
 
 // Definition variables
-#define definitionp(A)              tagged_listp(A, DEFINE)
+#define definitionp(A)              tagged_listp(A, lisp_define)
 cell definition_variable(cell exp);
 cell definition_value(cell exp);
 
+// Macros, (define-macro (name params) body) binds name to (macro . procedure). A call of the macro is replaced in
+// place by what the procedure returns for the call's operands, unevaluated, so each call site is expanded once
+#define macrop(A)                   tagged_listp(A, lisp_macro)
+#define macro_procedure(A)          cdr(A)
+cell eval_macro_definition(cell exp, cell env);
+cell lisp_macroexpand(cell macro, cell exp);
+cell lisp_splice(cell exp, cell expansion);
+
 // Lambda
-#define lambdap(A)                  tagged_listp(A, LAMBDA)
+#define lambdap(A)                  tagged_listp(A, lisp_lambda)
 #define lambda_parameters(A)        cadr(A)
 #define lambda_body(A)              cddr(A)
-#define mklambda(P, B)              cons(mksym(LAMBDA), cons(P,B))
+#define mklambda(P, B)              cons(lisp_lambda, cons(P,B))
+
+// Lexical addressing, see SICP 5.5.6
+#define LEXICAL_FREE                (-1)    // Not bound by any enclosing lambda, looked up by name
+#define LEXICAL_MAX                 INT16_MAX
+#define lexicalp(A)                 (lisp_typeof(A) == LEXICAL)
+#define lexical_depth(A)            ((A)->address.depth)
+#define lexical_slot(A)             ((A)->address.slot)
+#define lexical_freep(A)            (lexical_slot(A) == LEXICAL_FREE)
+#define lexical_name(A)             (lexical_freep(A) ? car(cdr(A)) : cdr(A))
+cell lexical_address(cell exp);
+cell lexical_value(cell address, cell env);
+cell lexical_assign(cell address, cell val, cell env);
+cell mklexical(int depth, int slot, cell var);
+
+// Inline caches, the free variables of lambda bodies remember the global value they were last found to have
+typedef struct {
+    size_t hits;        // Free variable references answered by their cache
+    size_t misses;      // Looked up by name, and cached if found in the global frame
+} lisp_cache_stats;
+
+lisp_cache_stats lisp_inline_cache_stats();
+void lisp_inline_cache_reset();
+
+// Analysis, see SICP 4.1.7
+// lisp_analyze turns an expression into a NODE cell once, lisp_execute runs it as often as needed
+typedef struct lisp_node {
+    struct cell *       (*exec)(struct lisp_node *node, struct cell *env);
+    struct cell         *datum;     // The constant, variable or parameters the node was made for, or nil
+    size_t               count;     // Nodes in `items'
+    uint32_t             stamp;     // Version of the globals a folded call was computed at
+    struct lisp_node    *items[];   // Operands, as taken apart by the analysis
+} lisp_node;
+
+#define nodep(A)                    (lisp_typeof(A) == NODE)
+cell lisp_analyze(cell exp);
+cell lisp_execute(cell node, cell env);
+
+// Bytecode, lisp_compile turns an expression into a CODE cell and lisp_run executes it on a stack machine
+typedef struct lisp_code {
+    size_t               length;        // Words in `ops'
+    size_t               count;         // Cells in `constants'
+    size_t               depth;         // Most values the code keeps on the operand stack
+    bool                 keeps_env;     // Makes closures, assigns or defines, a call needs a FRAME in the heap
+    int32_t             *ops;           // Opcodes and their operands, held after the constants
+    struct cell         *constants[];   // Referred to by index from `ops'
+} lisp_code;
+
+#define codep(A)                    (lisp_typeof(A) == CODE)
+cell lisp_compile(cell exp);
+cell lisp_run(cell code, cell env);
+
+// Explicit control, see SICP 5.4
+// lisp_ec_eval evaluates like eval, keeping its continuations on a stack in the heap rather than the C stack.
+// lisp_ec_max_depth sets the most entries that stack may hold and returns the previous limit
+cell lisp_ec_eval(cell exp, cell env);
+size_t lisp_ec_max_depth(size_t depth);
+
+// Evaluation a few steps at a time: lisp_eval_with_budget evaluates `exp' for at most `steps' steps of the explicit
+// control machine. Finished, it returns the result. Otherwise it returns the suspended machine, also held and rooted
+// by `state', and lisp_eval_resume gives it more steps. lisp_eval_abandon drops it. `state' must stay where it is
+// while suspended and be abandoned, or run to the end, before it is used again.
+typedef struct lisp_eval_state {
+    struct cell *machine;   // The suspended machine, nil when there is none
+    size_t steps;           // Steps taken since the evaluation began
+} lisp_eval_state;
+
+#define lisp_suspendedp(S)          (!nullp((S)->machine))
+cell lisp_eval_with_budget(cell exp, cell env, size_t steps, lisp_eval_state *state);
+cell lisp_eval_resume(lisp_eval_state *state, size_t steps);
+void lisp_eval_abandon(lisp_eval_state *state);
 
 // Conditionals
-#define ifp(A)                      tagged_listp(A, IF)
+#define ifp(A)                      tagged_listp(A, lisp_if)
 #define if_predicate(A)             cadr(A)
 #define if_consequent(A)            caddr(A)
 cell if_alternate(cell exp);
 cell mkif(cell predicate, cell consequent, cell altnerate);
 
 // Begin
-#define beginp(A)                   tagged_listp(A, BEGIN)
+#define beginp(A)                   tagged_listp(A, lisp_begin)
 #define begin_actions(A)            cdr(A)
 #define last_expp(A)                nullp(cdr(A))
 #define first_exp(A)                car(A)
@@ -190,10 +427,10 @@ cell mkbegin(cell seq);
 
 // Cond, seeing as SICP authors have done all the hard work, we can implement in C for speed and
 // also to reduce the size of the lisp programs
-#define condp(A)                    tagged_listp(A, COND)
+#define condp(A)                    tagged_listp(A, lisp_cond)
 #define cond_clauses(A)             cdr(A)
 #define cond_predicate(A)           car(A)
-#define cond_elsep(A)               lisp_eq(cond_predicate(A), ELSE)
+#define cond_elsep(A)               (cond_predicate(A) == lisp_else)
 #define cond_actions(A)             cdr(A)
 #define cond_if(A)                  expand_clauses(cond_clauses(A))
 cell expand_clauses(cell clauses);
@@ -209,7 +446,11 @@ bool numberp(cell exp);
 bool symbolp(cell exp);
 
 // Set up and tear down of lisp environment
+#ifdef WITH_STATIC_HEAP
+void lisp_init(void *buffer, size_t size);
+#else
 void lisp_init();
+#endif
 void lisp_cleanup();
 
 // Parsers
@@ -225,21 +466,56 @@ cell nth(cell list, int n);
 int lisp_length(cell exp);
 
 cell lisp_alloc   (enum lisp_type type, size_t length, any data, cell rest);
-void lisp_destroy (cell, cell);
+cell lisp_intern  (const char *name);
+void lisp_destroy (cell);
+void lisp_destroy_list(cell);
+size_t lisp_heap_pages();
+size_t lisp_object_count();
 cell mkfixnum     (lisp_fixnum l);
+cell mkchar       (lisp_char c);
 
 #define string_size(S)              (sizeof(lisp_char) * (S + 1))
 #define cons(A, B)                  lisp_alloc(CONS, lisp_sizeof(CONS), A, B)
-#define mkquote()                   mksym(QUOTE)
+#define mkquote()                   lisp_quote
 #define quote(A)                    cons(mkquote(), cons(A, nil))
-#define mksym(A)                    lisp_alloc(SYM, string_size(strlen(A)), (any) A, nil)
+#define mksym(A)                    lisp_intern(A)
 #define mkerror(A)                  lisp_alloc(ERROR, string_size(strlen(A)), (any) A, nil)
 #define mkstring(A)                 lisp_alloc(STRING, string_size(strlen(A)), A, nil)
 
 // Garbage Collector
-bool lisp_sweep();
+typedef struct {
+    size_t objects;     // Objects reclaimed
+    size_t bytes;       // Bytes reclaimed, cells and their payloads
+} lisp_gc_stats;
+
+lisp_gc_stats lisp_sweep();
 bool lisp_free(bool force_clean_all);
-cell find_object(cell address, cell objects);
+bool lisp_gc_root(cell *root);
+void lisp_gc_unroot(cell *root);
+bool lisp_gc_step(size_t budget);
+lisp_gc_stats lisp_gc_cycle_stats();
+lisp_gc_stats lisp_gc_minor();
+bool lisp_compact();
+
+// Regions
+bool lisp_region_begin();
+cell lisp_region_end(cell keep);
+
+// Quotas, a region in which allocating more than `cells' cells or `bytes' bytes fails. Cells come from the
+// region's arena, so `bytes' is clamped to LISP_REGION_BYTES, all the arena holds. lisp_quota_end returns an
+// ERROR instead of `keep' if the quota was exceeded. A failed message is not undone: whatever it stored into
+// older objects, such as a define or set! of a global, persists with the values stored. The NODE and CODE
+// cells it made with analyze or compile are charged, but are reclaimed by the collector rather than with the
+// arena
+typedef struct {
+    size_t cells;       // Cells allocated
+    size_t bytes;       // Bytes allocated, cells, payloads and the reader's buffers
+} lisp_quota_usage;
+
+bool lisp_quota_begin(size_t cells, size_t bytes);
+cell lisp_quota_end(cell keep);
+lisp_quota_usage lisp_quota_used();
+cell find_object(cell address);
 
 
 // Primitive features
@@ -247,6 +523,11 @@ cell sum(cell parms);
 cell divide(cell parms);
 cell subtract(cell parms);
 cell product(cell parms);
+cell compile(cell parms);
+cell construct(cell parms);
+cell first_of(cell parms);
+cell rest_of(cell parms);
+cell list_of(cell parms);
 cell reduce(cell fn, cell list);
 cell map(cell fn, cell list);
 
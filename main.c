@@ -1,5 +1,10 @@
 #include "lisp_mu.h"
 
+#ifdef WITH_STATIC_HEAP
+// Everything the interpreter allocates comes from this block
+static char heap[1024 * 1024];
+#endif
+
 int main() {
     printf("Hello, World!\n");
     printf("Sum of 15 and 56 = %d\n",  sum_int(2, 15, 56) );
@@ -7,7 +12,11 @@ int main() {
     printf("Sum of 15.5 and 56.6 = %f\n",  sum_double(2, 15.5, 56.6) );
 #endif
 
+#ifdef WITH_STATIC_HEAP
+    lisp_init(heap, sizeof heap);
+#else
     lisp_init();
+#endif
     cell result;
     // REPL
     do {
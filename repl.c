@@ -19,9 +19,18 @@ bool escaped = false;
 
 #define BUF_SIZE 1024
 
+#ifdef WITH_STATIC_HEAP
+// Everything the interpreter allocates comes from this block
+static char heap[1024 * 1024];
+#endif
+
 int main() {
     init_printf(NULL, my_putc);
+#ifdef WITH_STATIC_HEAP
+    lisp_init(heap, sizeof heap);
+#else
     lisp_init();
+#endif
     cell exp, result;
     char *buf;
     int i = 0;
@@ -3,6 +3,8 @@
 #include "tinyprintf.h"
 #include <assert.h>
 #include <time.h>
+#include <stdlib.h>
+#include <limits.h>
 
 #define STR(...) #__VA_ARGS__
 
@@ -13,6 +15,12 @@ int test_ctr = 0;
 #define stop_timer(E)       E = clock()
 #define time_diff(S, E)     ((int)((E - S) * 1000 / CLOCKS_PER_SEC))
 
+#ifdef WITH_STATIC_HEAP
+// The suite runs in a block of its own, test_static_heap uses a much tighter one
+static char test_heap[32 * 1024 * 1024];
+#define lisp_init()         lisp_init(test_heap, sizeof test_heap)
+#endif
+
 
 /*
 void test_sum_int();
@@ -32,6 +40,17 @@ void test_lisp_strings();
 void test_lisp_quote();
 void test_lisp_float();
 void test_gc_collect_all();
+void test_cell_allocator();
+void test_gc_sweep();
+void test_gc_incremental();
+void test_gc_minor();
+void test_gc_compact();
+void test_destroy_list();
+void test_region();
+void test_quota();
+void test_static_heap();
+void test_immediates();
+void test_symbols();
 void test_cons();
 void test_equals();
 void test_eval_define();
@@ -41,6 +60,16 @@ void test_eval_variablep();
 void test_eval_assignment();
 void test_eval_if();
 void test_eval_lambda();
+void test_lexical_addressing();
+void test_frames();
+void test_inline_cache();
+void test_analyze();
+void test_fold();
+void test_compile();
+void test_tail_calls();
+void test_explicit_control();
+void test_eval_budget();
+void test_macros();
 void test_eval_begin();
 void test_eval_cond();
 void test_eval_apply();
@@ -48,12 +77,26 @@ void test_map_reduce();
 void test_make_functions();
 void test_eval_primitive();
 void test_eval_environment();
+void test_global_env();
 void test_read_eval();
 void test_read_eval2();
 void test_read_eval3();
 
 void print_global_env();
 
+void bench_alloc();
+void bench_eval();
+void bench_analyze();
+void bench_fold();
+void bench_compile();
+void bench_tail_calls();
+void bench_explicit_control();
+void bench_gc();
+void bench_compact();
+void bench_symbols();
+void bench_dispatch();
+void bench_globals();
+
 
 void my_putc( void* p, char c) {
     putc(c, stdout);
@@ -82,6 +125,17 @@ int main() {
         test_lisp_float();              // Floating point, if enabled in mu_lisp.h
         test_equals();                  // Equivalence of lisp objects and between lisp / c objects
         test_gc_collect_all();          // garbage collect all memory (i.e. complete cleanup)
+        test_cell_allocator();          // cells are carved from pages and recycled
+        test_gc_sweep();                // mark and sweep non referenced objects
+        test_gc_incremental();          // time bounded collection interleaved with evaluation
+        test_gc_minor();                // nursery collections promote the survivors
+        test_gc_compact();              // live objects are moved together, lists in cdr order
+        test_destroy_list();            // explicit destruction of objects and whole structures
+        test_region();                  // arena allocation for the lifetime of a message
+        test_quota();                   // a limit on what one message may allocate
+        test_static_heap();             // running out of a caller provided block, if enabled in mu_lisp.h
+        test_immediates();              // fixnums, characters, nil and T, tagged if enabled in mu_lisp.h
+        test_symbols();                 // interning, a symbol is one cell however often it is read
 
         // Actual LISP functionality
         test_cons();                    // Ensure the sanity of cons'ing
@@ -92,16 +146,27 @@ int main() {
         test_eval_variablep();          // Evaluation of a variable (symbol lookup)
         test_eval_if();                 // eval if
         test_eval_lambda();             // eval lambda
+        test_lexical_addressing();      // variable references resolved to (depth, slot) ahead of time
+        test_frames();                  // a procedure call's values in one vector
+        test_inline_cache();            // free variables remember their global value
         test_eval_begin();              // eval begin
         test_make_functions();          // Making and calling primitive functions
         test_map_reduce();              // mapper and reducer
         test_eval_apply();              // eval application
         test_eval_primitive();          // eval then apply primitives
         test_eval_environment();
+        test_global_env();              // the hash index over the global frame
 
         test_read_eval();               // operators +,-,*,/ and defining functions using them
         test_read_eval2();              // =, multiple defines and recursion
         test_read_eval3();              // Even more primitives
+        test_analyze();                 // analysing once, executing many times
+        test_fold();                    // calls of pure primitives on constants made by the analysis
+        test_compile();                 // bytecode and the machine running it
+        test_tail_calls();              // constant C stack in tail positions
+        test_explicit_control();        // the register machine evaluator of SICP 5.4
+        test_eval_budget();             // evaluating a few steps at a time
+        test_macros();                  // define-macro, expanded once where it is called
 
         continue;
         test_eval_cond();               // TODO: eval cond
@@ -110,7 +175,6 @@ int main() {
         // Libraries exposed from C
         // TODO: Maths library
         // TODO: MAXLEN bounds tests
-        // TODO: Garbace collect non referenced objects
 
     }
     stop_timer(t_end);
@@ -122,9 +186,410 @@ int main() {
     } else {
         printf("Could not measure the speed, too fast\n");
     }
+
+    // Benchmarks
+    bench_alloc();
+    bench_eval();
+    bench_analyze();
+    bench_fold();
+    bench_compile();
+    bench_tail_calls();
+    bench_explicit_control();
+    bench_gc();
+    bench_compact();
+    bench_symbols();
+    bench_dispatch();
+    bench_globals();
     return 0;
 }
 
+void print_rate(const char *name, long ops, clock_t t_start, clock_t t_end) {
+    int ms = time_diff(t_start, t_end);
+    if (ms > 0)
+        printf("%s: %ld per ms\n", name, ops / ms);
+    else
+        printf("%s: too fast to measure\n", name);
+}
+
+/*
+ * Evaluation rate of a recursive, arithmetic heavy function, compare builds with and without
+ * WITH_TAGGED_IMMEDIATES
+ */
+void bench_eval() {
+    const int rounds = 2000;
+    clock_t t_start, t_end;
+    const char *prog;
+    cell exp;
+
+    lisp_init();
+    prog = STR(
+            (define (factorial n)
+                (if (= n 1)
+                    1
+                    (* n (factorial (- n 1)))))
+    );
+    eval(lisp_read(&prog), global_env);
+    prog = "(factorial 20)";
+    exp = lisp_read(&prog);
+
+    lisp_inline_cache_reset();
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        eval(exp, global_env);
+    }
+    stop_timer(t_end);
+    print_rate("Eval (factorial 20)", rounds, t_start, t_end);
+    lisp_cache_stats stats = lisp_inline_cache_stats();
+    printf("Inline caches: %ld hits, %ld misses\n", (long) stats.hits, (long) stats.misses);
+    lisp_cleanup();
+}
+
+/*
+ * The same factorial evaluated and executed from its analysis, the gap is the cost of examining syntax
+ * at run time
+ */
+void bench_analyze() {
+    const int rounds = 2000;
+    clock_t t_start, t_end;
+    const char *prog;
+    cell exp, node;
+
+    lisp_init();
+    prog = STR(
+            (define (factorial n)
+                (if (= n 1)
+                    1
+                    (* n (factorial (- n 1)))))
+    );
+    eval(lisp_read(&prog), global_env);
+    prog = "(factorial 20)";
+    exp = lisp_read(&prog);
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        eval(exp, global_env);
+    }
+    stop_timer(t_end);
+    print_rate("Eval (factorial 20)", rounds, t_start, t_end);
+
+    prog = STR(
+            (define (factorial n)
+                (if (= n 1)
+                    1
+                    (* n (factorial (- n 1)))))
+    );
+    lisp_execute(lisp_analyze(lisp_read(&prog)), global_env);
+    prog = "(factorial 20)";
+    node = lisp_analyze(lisp_read(&prog));
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        lisp_execute(node, global_env);
+    }
+    stop_timer(t_end);
+    print_rate("Analyzed (factorial 20)", rounds, t_start, t_end);
+    lisp_cleanup();
+}
+
+/*
+ * Arithmetic on constants evaluated each time and executed from its analysis, which folded it
+ */
+void bench_fold() {
+    const int rounds = 100000;
+    clock_t t_start, t_end;
+    const char *prog = "(* 1000 (+ 60 60))";
+    cell exp, node;
+
+    lisp_init();
+    exp = lisp_read(&prog);
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        eval(exp, global_env);
+    }
+    stop_timer(t_end);
+    print_rate("Eval (* 1000 (+ 60 60))", rounds, t_start, t_end);
+
+    node = lisp_analyze(exp);
+    start_timer(t_start);
+    for (int r = 0; r < rounds * 100; ++r) {
+        lisp_execute(node, global_env);
+    }
+    stop_timer(t_end);
+    print_rate("Folded (* 1000 (+ 60 60))", rounds * 100, t_start, t_end);
+    lisp_cleanup();
+}
+
+/*
+ * The programs of test_read_eval2 evaluated and run as bytecode
+ */
+void bench_compile() {
+    const int rounds = 20000;
+    clock_t t_start, t_end;
+    const char *prog;
+    cell exp, code;
+    const char *defines = STR(
+            (begin
+                (define (factorial n)
+                    (if (= n 1)
+                        1
+                        (* n (factorial (- n 1)))))
+                (define (square x)
+                    (* x x))
+                (define (sum-of-squares x y)
+                    (+ (square x) (square y)))
+                (define (f a)
+                    (sum-of-squares (+ a 1) (+ a 2))))
+    );
+    const char *programs[] = { "(factorial 20)", "(f 5)" };
+
+    for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); ++i) {
+        char name[64];
+        lisp_init();
+        prog = defines;
+        eval(lisp_read(&prog), global_env);
+        prog = programs[i];
+        exp = lisp_read(&prog);
+        start_timer(t_start);
+        for (int r = 0; r < rounds; ++r) {
+            eval(exp, global_env);
+        }
+        stop_timer(t_end);
+        snprintf(name, sizeof(name), "Eval %s", programs[i]);
+        print_rate(name, rounds, t_start, t_end);
+
+        prog = defines;
+        lisp_run(lisp_compile(lisp_read(&prog)), global_env);
+        prog = programs[i];
+        code = lisp_compile(lisp_read(&prog));
+        start_timer(t_start);
+        for (int r = 0; r < rounds; ++r) {
+            lisp_run(code, global_env);
+        }
+        stop_timer(t_end);
+        snprintf(name, sizeof(name), "Bytecode %s", programs[i]);
+        print_rate(name, rounds, t_start, t_end);
+        lisp_cleanup();
+    }
+}
+
+/*
+ * A million iterations of a tail recursive loop, in the C stack of ten
+ */
+void bench_tail_calls() {
+    const long rounds = 1000000;
+    clock_t t_start, t_end;
+    const char *prog;
+    size_t shallow;
+    cell exp, result;
+    lisp_init();
+
+    prog = "(define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1))))";
+    eval(lisp_read(&prog), global_env);
+    prog = "(loop 10 0)";
+    lisp_stack_reset();
+    eval(lisp_read(&prog), global_env);
+    shallow = lisp_stack_high_water();
+    prog = "(loop 1000000 0)";
+    exp = lisp_read(&prog);
+    lisp_stack_reset();
+    start_timer(t_start);
+    result = eval(exp, global_env);
+    stop_timer(t_end);
+    print_rate("Eval tail loop iterations", rounds, t_start, t_end);
+    printf("Tail loop of 1000000 %s, C stack %d bytes, %d bytes for 10\n",
+           errorp(result) ? "stopped by an ERROR" : "finished",
+           (int) lisp_stack_high_water(), (int) shallow);
+    lisp_cleanup();
+}
+
+/*
+ * Recursion far deeper than eval could go on the C stack of a small device
+ */
+void bench_explicit_control() {
+    const int rounds = 20000;
+    clock_t t_start, t_end;
+    const char *prog;
+    cell exp, result;
+    lisp_init();
+
+    prog = "(define (factorial n) (if (= n 1) 1 (* n (factorial (- n 1)))))";
+    eval(lisp_read(&prog), global_env);
+    prog = "(factorial 20)";
+    exp = lisp_read(&prog);
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        lisp_ec_eval(exp, global_env);
+    }
+    stop_timer(t_end);
+    print_rate("Explicit control (factorial 20)", rounds, t_start, t_end);
+
+    lisp_eval_state state;
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        lisp_eval_with_budget(exp, global_env, 100, &state);
+        while (lisp_suspendedp(&state)) lisp_eval_resume(&state, 100);
+    }
+    stop_timer(t_end);
+    print_rate("Budgets of 100 steps (factorial 20)", rounds, t_start, t_end);
+
+    prog = "(define (count n) (if (= n 0) 0 (+ 1 (count (- n 1)))))";
+    eval(lisp_read(&prog), global_env);
+    prog = "(count 100000)";
+    exp = lisp_read(&prog);
+    size_t limit = lisp_ec_max_depth(1024 * 1024);
+    start_timer(t_start);
+    result = lisp_ec_eval(exp, global_env);
+    stop_timer(t_end);
+    lisp_ec_max_depth(limit);
+    print_rate("Explicit control recursion depth", 100000, t_start, t_end);
+    printf("Recursion 100000 deep %s\n", errorp(result) ? "stopped by an ERROR" : "finished");
+    lisp_cleanup();
+}
+
+/*
+ * Cost of collecting after every evaluation with a large old heap, a minor collection only touches the
+ * survivors while a full collection marks and sweeps everything. A region drops the arena at once.
+ */
+void bench_gc() {
+    const int rounds = 500;
+    clock_t t_start, t_end;
+    const char *prog;
+    cell exp, kept;
+
+    lisp_init();
+    kept = nil;
+    lisp_gc_root(&kept);
+    for (int i = 0; i < 20000; ++i) kept = cons(nil, kept);
+    prog = STR(
+            (define (factorial n)
+                (if (= n 1)
+                    1
+                    (* n (factorial (- n 1)))))
+    );
+    eval(lisp_read(&prog), global_env);
+    prog = "(factorial 10)";
+    exp = lisp_read(&prog);
+    lisp_gc_root(&exp);
+    lisp_sweep();
+
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        eval(exp, global_env);
+        lisp_gc_minor();
+    }
+    stop_timer(t_end);
+    print_rate("GC minor after (factorial 10)", rounds, t_start, t_end);
+
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        eval(exp, global_env);
+        lisp_sweep();
+    }
+    stop_timer(t_end);
+    print_rate("GC full after (factorial 10)", rounds, t_start, t_end);
+
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        lisp_region_begin();
+        eval(exp, global_env);
+        lisp_region_end(nil);
+    }
+    stop_timer(t_end);
+    print_rate("GC region around (factorial 10)", rounds, t_start, t_end);
+    lisp_cleanup();
+}
+
+/*
+ * Walking a long list whose cells were allocated in a shuffled order, before and after lisp_compact has
+ * laid it out in cdr order
+ */
+void bench_compact() {
+    const int cells = 200000;
+    const int rounds = 50;
+    clock_t t_start, t_end;
+    static cell nodes[200000];
+    cell list, c;
+    long n = 0;
+
+    lisp_init();
+    for (int i = 0; i < cells; ++i) nodes[i] = cons(nil, nil);
+    srand(1);
+    for (int i = cells - 1; i > 0; --i) {
+        int j = rand() % (i + 1);
+        c = nodes[i]; nodes[i] = nodes[j]; nodes[j] = c;
+    }
+    for (int i = 0; i < cells - 1; ++i) setcdrb(nodes[i], nodes[i + 1]);
+    list = nodes[0];
+    lisp_gc_root(&list);
+
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        for (c = list; !nullp(c); c = cdr(c)) n++;
+    }
+    stop_timer(t_end);
+    print_rate("Walk fragmented list", n, t_start, t_end);
+
+    lisp_compact();
+    n = 0;
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        for (c = list; !nullp(c); c = cdr(c)) n++;
+    }
+    stop_timer(t_end);
+    print_rate("Walk compacted list", n, t_start, t_end);
+    lisp_cleanup();
+}
+
+/*
+ * Allocation rate of the cell pages against the calloc + payload malloc per object they replaced
+ */
+void bench_alloc() {
+    const int rounds = 200;
+    const int cells = 5000;
+    clock_t t_start, t_end;
+    static any objs[5000];
+    static any payloads[5000];
+
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < cells; ++i) {
+            objs[i] = calloc(1, sizeof(lisp_cell));
+            payloads[i] = malloc(sizeof(lisp_fixnum));
+        }
+        for (int i = 0; i < cells; ++i) {
+            free(payloads[i]);
+            free(objs[i]);
+        }
+    }
+    stop_timer(t_end);
+    print_rate("Alloc calloc+malloc fixnums", (long)rounds * cells, t_start, t_end);
+
+    lisp_init();
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < cells; ++i) mkfixnum(i);
+        lisp_free(true);
+    }
+    stop_timer(t_end);
+    print_rate("Alloc mkfixnum", (long)rounds * cells, t_start, t_end);
+
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < cells; ++i) cons(nil, nil);
+        lisp_free(true);
+    }
+    stop_timer(t_end);
+    print_rate("Alloc cons", (long)rounds * cells, t_start, t_end);
+
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        cell list = nil;
+        for (int i = 0; i < cells; ++i) list = cons(mkstring("s"), list);
+        lisp_destroy_list(list);
+    }
+    stop_timer(t_end);
+    print_rate("Alloc and lisp_destroy_list strings", (long)rounds * cells, t_start, t_end);
+    lisp_cleanup();
+}
+
 
 void test_read_eval2() {
     lisp_init();
@@ -208,6 +673,66 @@ void test_read_eval3() {
     lisp_cleanup();
 }
 
+void test_global_env() {
+    cell exp;
+    const char *prog;
+    char def[64];
+    lisp_init();
+
+    for (int i = 0; i < 300; ++i) {
+        sprintf(def, "(define g%d %d)", i, i);
+        prog = def;
+        eval(lisp_read(&prog), global_env);
+    }
+    prog = "(+ g0 g299)";
+    assert_ctr(fixnum(eval(lisp_read(&prog), global_env)) == 299 && "test_global_env() :: first and last globals");
+    prog = "(define g0 1000)";
+    eval(lisp_read(&prog), global_env);
+    prog = "(set! g299 2000)";
+    eval(lisp_read(&prog), global_env);
+    prog = "(+ g0 g299)";
+    assert_ctr(fixnum(eval(lisp_read(&prog), global_env)) == 3000 && "test_global_env() :: redefinition and assignment");
+    exp = first_frame(global_env);
+    assert_ctr(lisp_length(frame_variables(exp)) == lisp_length(frame_values(exp)) &&
+               car(frame_variables(exp)) == mksym("g299") && fixnum(car(frame_values(exp))) == 2000 &&
+               "test_global_env() :: the frame's lists are kept up to date");
+    prog = "g300";
+    assert_ctr(errorp(eval(lisp_read(&prog), global_env)) && "test_global_env() :: unbound globals");
+    prog = "(set! g300 1)";
+    assert_ctr(errorp(eval(lisp_read(&prog), global_env)) && "test_global_env() :: assigning unbound globals");
+
+    // Local frames still shadow the global one
+    prog = "(define (shadow g1) (+ g1 g2))";
+    eval(lisp_read(&prog), global_env);
+    prog = "(shadow 40)";
+    assert_ctr(fixnum(eval(lisp_read(&prog), global_env)) == 42 && "test_global_env() :: parameters shadow globals");
+
+    // Collections that move the bindings
+    prog = "(define moved 1)";
+    eval(lisp_read(&prog), global_env);
+    lisp_gc_minor();
+    prog = "(set! moved (+ moved 1))";
+    eval(lisp_read(&prog), global_env);
+    lisp_compact();
+    lisp_region_begin();
+    prog = "(define regional (+ moved 1))";
+    eval(lisp_read(&prog), global_env);
+    lisp_region_end(nil);
+    prog = "(+ moved regional g2)";
+    assert_ctr(fixnum(eval(lisp_read(&prog), global_env)) == 7 && "test_global_env() :: bindings survive being moved");
+
+    // Any other environment is searched as before, including one the host makes global
+    exp = global_env;
+    global_env = extend_environment(cons(mksym("g1"), nil), cons(mkfixnum(-1), nil), exp);
+    prog = "(+ g1 g2)";
+    assert_ctr(fixnum(eval(lisp_read(&prog), global_env)) == 1 && "test_global_env() :: a new global frame is indexed");
+    global_env = exp;
+    prog = "(+ g1 g2)";
+    assert_ctr(fixnum(eval(lisp_read(&prog), global_env)) == 3 && "test_global_env() :: and so is the old one again");
+
+    lisp_cleanup();
+}
+
 void test_read_eval() {
     lisp_init();
     cell exp, result;
@@ -219,7 +744,7 @@ void test_read_eval() {
 
     prog = "'K";
     result = eval(lisp_read(&prog), global_env);
-    assert_ctr(result->type == SYM && lisp_eq(result, "K") && "We can read a symbol");
+    assert_ctr(lisp_typeof(result) == SYM && lisp_eq(result, "K") && "We can read a symbol");
 
     prog = "(+ 1 2 3)";
     result = eval(lisp_read(&prog), global_env);
@@ -442,6 +967,20 @@ void test_eval() {
     assert_ctr(exp == result && "test_eval() :: floats should be returned");
 #endif
 
+    // Dispatch on the form carried by the operator symbol
+    assert_ctr(special_form(mksym("quote")) == FORM_QUOTE && special_form(mksym("set!")) == FORM_SETB &&
+               special_form(mksym("define")) == FORM_DEFINE && special_form(mksym("if")) == FORM_IF &&
+               special_form(mksym("lambda")) == FORM_LAMBDA && special_form(mksym("begin")) == FORM_BEGIN &&
+               special_form(mksym("cond")) == FORM_COND && "test_eval() :: special form symbols carry their form");
+    assert_ctr(special_form(mksym("else")) == FORM_NONE && special_form(mkfixnum(1)) == FORM_NONE &&
+               special_form(nil) == FORM_NONE && special_form(lisp_true) == FORM_NONE &&
+               "test_eval() :: other objects are no special form");
+    const char *prog = "(define (f if) (+ if 1))";
+    eval(lisp_read(&prog), global_env);
+    prog = "(f 2)";
+    result = eval(lisp_read(&prog), global_env);
+    assert_ctr(fixnum(result) == 3 && "test_eval() :: a special form's name can still be a variable");
+
     lisp_cleanup();
 }
 
@@ -548,6 +1087,55 @@ void test_equals() {
     lisp_cleanup();
 }
 
+void test_symbols() {
+    cell exp, sym, kept;
+    const char *prog;
+    lisp_init();
+    kept = nil;
+    lisp_gc_root(&kept);
+
+    sym = mksym("interned");
+    assert_ctr(mksym("interned") == sym && lisp_eq(sym, "interned") && "test_symbols() :: a name makes one symbol");
+    assert_ctr(mksym("Interned") != sym && "test_symbols() :: names are case sensitive");
+    assert_ctr(mksym(T) == lisp_true && mksym("quote") == lisp_quote && mksym("if") == lisp_if &&
+               "test_symbols() :: the specials are interned");
+
+    prog = "(interned 'interned (interned))";
+    exp = lisp_read(&prog);
+    assert_ctr(car(exp) == sym && cadr(cadr(exp)) == sym && car(caddr(exp)) == sym && car(cadr(exp)) == lisp_quote &&
+               "test_symbols() :: the reader interns");
+    size_t l = lisp_object_count();
+    prog = "(interned interned interned)";
+    exp = lisp_read(&prog);
+    assert_ctr(lisp_object_count() == l + 3 && "test_symbols() :: reading a known symbol allocates nothing but the list");
+
+    // The table does not keep symbols alive, those still referred to survive
+    kept = cons(mksym("kept"), nil);
+    lisp_sweep();
+    assert_ctr(nullp(find_object(sym)) && "test_symbols() :: unreferenced symbols are collected");
+    sym = mksym("interned");
+    assert_ctr(lisp_eq(sym, "interned") && mksym("interned") == sym && "test_symbols() :: collected symbols are made again");
+    assert_ctr(car(kept) == mksym("kept") && "test_symbols() :: referenced symbols survive");
+
+    // Neither compaction nor regions lose a symbol's identity
+    lisp_compact();
+    assert_ctr(car(kept) == mksym("kept") && "test_symbols() :: compaction keeps the table up to date");
+    lisp_region_begin();
+    sym = mksym("regional");
+    assert_ctr(!lisp_arenap(sym) && "test_symbols() :: symbols are not allocated in the arena");
+    setcdrb(kept, cons(sym, nil));
+    lisp_region_end(nil);
+    assert_ctr(cadr(kept) == sym && mksym("regional") == sym && "test_symbols() :: symbols outlive the region");
+
+    prog = "(define (same? a b) (= a b))";
+    eval(lisp_read(&prog), global_env);
+    prog = "(same? 'kept 'kept)";
+    assert_ctr(eval(lisp_read(&prog), global_env) == lisp_true && "test_symbols() :: equal symbols are the same cell");
+
+    lisp_gc_unroot(&kept);
+    lisp_cleanup();
+}
+
 void test_cons() {
     lisp_init();
 
@@ -556,7 +1144,7 @@ void test_cons() {
     n2 = mkfixnum(6);
     exp = cons(n1, n2);
 
-    assert_ctr(exp -> type == CONS && "test_cons() :: should be a cons");
+    assert_ctr(lisp_typeof(exp) == CONS && "test_cons() :: should be a cons");
     assert_ctr(fixnum(car(exp)) == 3  && "test_cons() :: Symbol should be 3");
     assert_ctr(fixnum(cdr(exp)) == 6  && "test_cons() :: Symbol should be 6");
 
@@ -568,33 +1156,539 @@ void test_gc_collect_all() {
     cell obj;
     const char *ptr;
     lisp_init();
-#ifdef DEBUG
-    lisp_pprint(all_objects,0);
-#endif
 
-    int l = lisp_length(all_objects);
+    size_t l = lisp_object_count();
 
-    assert_ctr(lisp_length(all_objects) > 0 && "test_gc_collect_all() :: There is a single nil object plus all inits");
+    assert_ctr(lisp_object_count() > 0 && "test_gc_collect_all() :: There is a single nil object plus all inits");
     ptr = "(1 2 3)";
     exp = lisp_read(&ptr);
 
-#ifdef DEBUG
-    lisp_print_list(all_objects);
-    lisp_pprint(all_objects,0);
+#ifdef WITH_TAGGED_IMMEDIATES
+    assert_ctr((lisp_object_count() == 3 + l) && "test_gc_collect_all() :: 3 for the list, fixnums are immediate");
+#else
+    assert_ctr((lisp_object_count() == 6 + l) && "test_gc_collect_all() :: 6 for the list");
+
+    obj = find_object(car(exp));
+    assert_ctr(car(exp) == obj && "test_gc_collect_all() :: can find an object in the heap");
+
+    obj = find_object(second(exp));
+    assert_ctr(second(exp) == obj && "test_gc_collect_all() :: can find another object in the heap");
 #endif
-    assert_ctr((lisp_length(all_objects) == 6 + l) && "test_gc_collect_all() :: 6 for the list");
 
-    obj = find_object(car(exp), all_objects);
-    assert_ctr(car(exp) == car(obj) && "test_gc_collect_all() :: can find an object in all_objects");
+    obj = find_object(rest(exp));
+    assert_ctr(rest(exp) == obj && "test_gc_collect_all() :: can find a cons in the heap");
 
-    obj = find_object(second(exp), all_objects);
-    assert_ctr(second(exp) == car(obj) && "test_gc_collect_all() :: can find another object in all_objects");
+    lisp_destroy(exp);
+    assert_ctr(nullp(find_object(exp)) && "test_gc_collect_all() :: destroyed objects are not found");
+    assert_ctr(nullp(find_object((cell) &l)) && "test_gc_collect_all() :: objects outside the heap are not found");
+
+    lisp_free(true);
+#ifdef WITH_TAGGED_IMMEDIATES
+    assert_ctr(lisp_object_count() == 0 && "test_gc_collect_all() :: Everything gone, nil is immediate");
+#else
+    assert_ctr(lisp_object_count() == 1 && "test_gc_collect_all() :: Everything gone, except the final nil");
+#endif
 
-    obj = find_object(rest(exp), all_objects);
-    assert_ctr(rest(exp) == car(obj) && "test_gc_collect_all() :: can find a cons in all_objects");
+    lisp_cleanup();
+}
+
+void test_gc_sweep() {
+    cell exp, kept, cycle;
+    const char *ptr;
+    lisp_gc_stats stats;
+    lisp_init();
+
+    size_t l = lisp_object_count();
+    stats = lisp_sweep();
+    assert_ctr(stats.objects == 0 && lisp_object_count() == l && "test_gc_sweep() :: the environment survives");
+
+    ptr = "(1 2 \"abc\" (x))";
+    exp = lisp_read(&ptr);
+    size_t garbage = lisp_object_count() - l;
+    stats = lisp_sweep();
+    assert_ctr(stats.objects == garbage && "test_gc_sweep() :: unreferenced objects are reclaimed");
+    assert_ctr(stats.bytes == garbage * sizeof(lisp_cell) + 4 + 2 && "test_gc_sweep() :: payloads are counted");
+    assert_ctr(lisp_object_count() == l && "test_gc_sweep() :: heap is back to the environment");
+
+    ptr = "(define (sqr y) (* y y))";
+    eval(lisp_read(&ptr), global_env);
+    lisp_sweep();
+    ptr = "(sqr 5)";
+    exp = eval(lisp_read(&ptr), global_env);
+    assert_ctr(fixnum(exp) == 25 && "test_gc_sweep() :: definitions survive");
+
+    kept = mklist(2, mkstring("kept"), mkfixnum(1));
+    lisp_gc_root(&kept);
+    lisp_sweep();
+    assert_ctr(lisp_eq(car(kept), "kept") && nullp(find_object(kept)) == false && "test_gc_sweep() :: roots survive");
+
+    cycle = cons(mkstring("cycle"), nil);
+    setcdrb(cycle, cycle);
+    stats = lisp_sweep();
+    assert_ctr(stats.objects == 2 && "test_gc_sweep() :: unreferenced cycles are reclaimed");
+
+    cycle = cons(mkstring("cycle"), nil);
+    setcdrb(cycle, cons(mkfixnum(1), cycle));
+    setcdrb(cdr(kept), cons(cycle, nil));
+    stats = lisp_sweep();
+    assert_ctr(stats.objects == 0 && "test_gc_sweep() :: referenced cycles survive");
+
+    exp = nil;
+    for (int i = 0; i < LISP_MARK_STACK * 4; ++i) exp = cons(exp, mkstring("deep"));
+    setcdrb(cddr(kept), cons(exp, nil));
+    l = lisp_object_count();
+    stats = lisp_sweep();
+    assert_ctr(stats.objects == 0 && lisp_object_count() == l && "test_gc_sweep() :: deep structures overflowing the mark stack survive");
+
+    lisp_gc_unroot(&kept);
+    stats = lisp_sweep();
+    assert_ctr(stats.objects >= LISP_MARK_STACK * 8 && "test_gc_sweep() :: unrooted objects are reclaimed");
+
+    lisp_cleanup();
+}
+
+void test_gc_incremental() {
+    cell exp, kept, moved;
+    const char *ptr;
+    lisp_init();
+
+    kept = nil;
+    for (int i = 0; i < 100; ++i) kept = cons(mkstring("kept"), kept);
+    lisp_gc_root(&kept);
+    lisp_sweep();
+    size_t garbage = lisp_object_count();
+    ptr = "(1 2 \"abc\" (x))";
+    exp = lisp_read(&ptr);
+    lisp_gc_minor();    // A major cycle leaves young garbage to the minor collections
+    garbage = lisp_object_count() - garbage;
+
+    int steps = 1;
+    while (!lisp_gc_step(10)) steps++;
+    assert_ctr(steps > 10 && "test_gc_incremental() :: a cycle is spread over many steps");
+    assert_ctr(lisp_gc_cycle_stats().objects == garbage && "test_gc_incremental() :: the cycle reports what it reclaimed");
+    assert_ctr(lisp_eq(car(kept), "kept") && lisp_length(kept) == 100 && "test_gc_incremental() :: roots survive");
+
+    // Start a cycle, which scans the head of `kept', then hide the white rest of it behind a new black cell
+    lisp_gc_step(1);
+    moved = cddr(kept);
+    exp = cons(mkstring("new"), nil);
+    setcdrb(cdr(kept), exp);
+    setcdrb(exp, moved);
+    ptr = "(define later (quote (1 2)))";
+    eval(lisp_read(&ptr), global_env);
+    while (!lisp_gc_step(10));
+    assert_ctr(lisp_length(kept) == 101 && lisp_eq(caddr(kept), "new") && "test_gc_incremental() :: the write barrier keeps moved cells");
+    assert_ctr(lisp_eq(nth(kept, 101), "kept") && "test_gc_incremental() :: the write barrier keeps moved cells");
+    ptr = "later";
+    exp = eval(lisp_read(&ptr), global_env);
+    assert_ctr(fixnum(cadr(exp)) == 2 && "test_gc_incremental() :: definitions made while marking survive");
+
+    lisp_gc_unroot(&kept);
+    while (!lisp_gc_step(10));
+    while (!lisp_gc_step(10));
+    assert_ctr(lisp_gc_cycle_stats().objects == 0 && "test_gc_incremental() :: nothing left to collect");
+
+    lisp_cleanup();
+}
+
+void test_cell_allocator() {
+    lisp_init();
+
+    assert_ctr(lisp_heap_pages() > 0 && "test_cell_allocator() :: lisp_init carves cells from a page");
+
+    size_t pages = lisp_heap_pages();
+    for (int i = 0; i < LISP_PAGE_CELLS; ++i) mkstring("a");   // Strings bypass the nursery
+    assert_ctr(lisp_heap_pages() > pages && "test_cell_allocator() :: heap grows a page at a time");
 
     lisp_free(true);
-    assert_ctr(lisp_length(all_objects) == 1 && "test_gc_collect_all() :: Everything gone, except the final nil");
+    pages = lisp_heap_pages();
+    for (int i = 0; i < LISP_PAGE_CELLS; ++i) mkstring("a");
+    assert_ctr(lisp_heap_pages() == pages && "test_cell_allocator() :: freed cells are reused before growing");
+
+    lisp_cleanup();
+}
+
+void test_gc_minor() {
+    lisp_gc_stats stats;
+    cell kept, exp, c;
+    const char *prog;
+
+    lisp_init();
+    kept = nil;
+    lisp_gc_root(&kept);
+    lisp_gc_minor();
+    size_t l = lisp_object_count();
+
+    for (int i = 0; i < 10; ++i) kept = cons(nil, kept);
+    for (int i = 0; i < 100; ++i) cons(nil, nil);
+    assert_ctr(lisp_youngp(kept) && "test_gc_minor() :: conses are born in the nursery");
+    assert_ctr(!lisp_youngp(mkstring("a")) && "test_gc_minor() :: payloads are allocated old");
+    stats = lisp_gc_minor();
+    assert_ctr(stats.objects == 100 && "test_gc_minor() :: young garbage is reclaimed");
+    assert_ctr(lisp_object_count() == l + 11 && "test_gc_minor() :: survivors are promoted, the string stays");
+    assert_ctr(!lisp_youngp(kept) && lisp_length(kept) == 10 && "test_gc_minor() :: the root follows its object");
+
+    // The remembered set keeps young cells referenced only from the old space
+    setcarb(kept, cons(nil, cons(nil, nil)));
+    stats = lisp_gc_minor();
+    assert_ctr(stats.objects == 0 && lisp_length(car(kept)) == 2 && !lisp_youngp(car(kept)) &&
+               "test_gc_minor() :: old to young references survive");
+
+    // More old cells pointing into the nursery than the remembered set holds
+    for (int i = 0; i < LISP_REMEMBERED * 2; ++i) kept = cons(nil, kept);
+    lisp_gc_minor();
+    for (c = kept; !nullp(c); c = cdr(c)) setcarb(c, cons(nil, nil));
+    lisp_gc_minor();
+    for (c = kept; !nullp(c) && pairp(car(c)) && !lisp_youngp(car(c)); c = cdr(c));
+    assert_ctr(nullp(c) && "test_gc_minor() :: an overflowing remembered set falls back to a heap scan");
+
+    // Definitions point from the old global environment into the nursery
+    prog = "(define lst (quote (1 2 3)))";
+    eval(lisp_read(&prog), global_env);
+    lisp_gc_minor();
+    prog = "lst";
+    exp = eval(lisp_read(&prog), global_env);
+    assert_ctr(lisp_length(exp) == 3 && fixnum(third(exp)) == 3 && "test_gc_minor() :: definitions survive");
+
+    // Promotion in the middle of an incremental cycle
+    lisp_gc_step(1);
+    kept = cons(cons(nil, nil), kept);
+    lisp_gc_minor();
+    lisp_sweep();
+    assert_ctr(pairp(car(kept)) && lisp_length(kept) == LISP_REMEMBERED * 2 + 11 &&
+               "test_gc_minor() :: promoted cells survive the marking cycle");
+
+    // Young cells shaded once the mark stack is full are left to the rescan, as old ones are
+    lisp_gc_minor();
+    exp = nil;
+    for (int i = 0; i < LISP_MARK_STACK * 2; ++i) exp = cons(mkstring("young"), exp);
+    lisp_gc_root(&exp);
+    lisp_gc_step(1);
+    for (c = exp; !nullp(c); c = cdr(c)) setcarb(kept, c);
+    while (!lisp_gc_step(10));
+    for (c = exp; !nullp(c) && lisp_eq(car(c), "young"); c = cdr(c));
+    assert_ctr(lisp_youngp(exp) && nullp(c) && "test_gc_minor() :: young cells overflowing the mark stack are rescanned");
+    lisp_gc_unroot(&exp);
+
+    lisp_gc_unroot(&kept);
+    lisp_cleanup();
+}
+
+void test_gc_compact() {
+    cell kept, exp, c;
+    const char *prog;
+
+    lisp_init();
+    kept = nil;
+    lisp_gc_root(&kept);
+    prog = "(define lst (quote (1 2 \"abc\" (x))))";
+    eval(lisp_read(&prog), global_env);
+
+    // Scatter a list over the pages, every tenth string survives the sweep
+    for (int i = 0; i < LISP_PAGE_CELLS * 10; ++i) {
+        exp = mkstring("kept");
+        if (i % 10 == 0) kept = cons(exp, kept);
+    }
+    lisp_sweep();
+    size_t pages = lisp_heap_pages();
+    size_t count = lisp_object_count();
+
+    assert_ctr(lisp_compact() && "test_gc_compact() :: compaction succeeds");
+    assert_ctr(lisp_heap_pages() < pages && "test_gc_compact() :: the holes are given back");
+    assert_ctr(lisp_object_count() == count && "test_gc_compact() :: every live object is kept");
+    assert_ctr(lisp_length(kept) == LISP_PAGE_CELLS && lisp_eq(car(kept), "kept") &&
+               "test_gc_compact() :: roots are updated");
+    for (c = kept; !nullp(cdr(c)) && cdr(c) == c + 1; c = cdr(c));
+    assert_ctr(c - kept >= LISP_PAGE_CELLS / 2 && "test_gc_compact() :: the spine of a list is laid out in cdr order");
+
+    prog = "lst";
+    exp = eval(lisp_read(&prog), global_env);
+    assert_ctr(lisp_length(exp) == 4 && lisp_eq(caddr(exp), "abc") && symbolp(car(cadddr(exp))) &&
+               "test_gc_compact() :: the global environment is updated");
+    prog = "(define (double n) (* n 2))";
+    eval(lisp_read(&prog), global_env);
+    prog = "(double 21)";
+    exp = eval(lisp_read(&prog), global_env);
+    assert_ctr(fixnum(exp) == 42 && "test_gc_compact() :: the interpreter carries on");
+
+    lisp_gc_unroot(&kept);
+    lisp_cleanup();
+}
+
+void test_destroy_list() {
+    cell exp, c;
+    const char *prog;
+
+    lisp_init();
+    size_t l = lisp_object_count();
+    exp = mkstring("once");
+    lisp_destroy(exp);
+    lisp_destroy(exp);
+    assert_ctr(lisp_object_count() == l && "test_destroy_list() :: destroying twice is harmless");
+
+    prog = "(1 \"two\" (three (4 five)) \"six\")";
+    exp = lisp_read(&prog);
+    lisp_destroy_list(exp);
+    assert_ctr(lisp_object_count() == l + 2 && "test_destroy_list() :: the whole structure is destroyed, but its symbols");
+    lisp_sweep();
+    assert_ctr(lisp_object_count() == l && "test_destroy_list() :: symbols are left to the collector");
+
+    // Shared and circular structure
+    c = cons(mkstring("shared"), nil);
+    exp = cons(c, cons(c, c));
+    setcdrb(c, exp);
+    lisp_destroy_list(exp);
+    assert_ctr(lisp_object_count() == l && "test_destroy_list() :: shared cells are destroyed once");
+
+    // A procedure refers to global_env, which must survive
+    prog = "(define (inc n) (+ n 1))";
+    eval(lisp_read(&prog), global_env);
+    l = lisp_object_count();
+    prog = "(lambda (n) (* n 2))";
+    exp = eval(lisp_read(&prog), global_env);
+    lisp_destroy_list(exp);
+    prog = "(inc 41)";
+    exp = eval(lisp_read(&prog), global_env);
+    assert_ctr(fixnum(exp) == 42 && "test_destroy_list() :: environments are left alone");
+
+    // A closure shares its frame, parameters and body with every other procedure made there
+    prog = "(define (mk k) (lambda (x) (* x k)))";
+    eval(lisp_read(&prog), global_env);
+    prog = "(mk 3)";
+    lisp_destroy_list(eval(lisp_read(&prog), global_env));
+    prog = "((mk 4) 5)";
+    exp = eval(lisp_read(&prog), global_env);
+    assert_ctr(fixnum(exp) == 20 && "test_destroy_list() :: a closure's frame and source are left alone");
+
+    // Long lists take neither quadratic time nor C stack
+    l = lisp_object_count();
+    exp = nil;
+    for (int i = 0; i < LISP_NURSERY_CELLS * 2; ++i) exp = cons(cons(mkfixnum(i), nil), exp);
+    lisp_destroy_list(exp);
+    assert_ctr(lisp_object_count() == l && "test_destroy_list() :: long lists are destroyed");
+
+    lisp_cleanup();
+}
+
+void test_region() {
+    cell exp, kept, c;
+    const char *prog;
+    const int overflow = LISP_REGION_BYTES / sizeof(lisp_cell) / 2;  // A cons and a string each time round
+
+    lisp_init();
+    kept = nil;
+    lisp_gc_root(&kept);
+    prog = "(define x 5)";
+    eval(lisp_read(&prog), global_env);
+    size_t l = lisp_object_count();
+
+    assert_ctr(lisp_region_begin() && !lisp_region_begin() && "test_region() :: regions do not nest");
+    prog = "(define (sq n) (* n n))";
+    eval(lisp_read(&prog), global_env);
+    prog = "(set! x \"five\")";
+    eval(lisp_read(&prog), global_env);
+    prog = "(quote (a \"b\" (c)))";
+    exp = eval(lisp_read(&prog), global_env);
+    // Bar the symbols first seen here, sq n a c, which are interned in the pages
+    assert_ctr(lisp_arenap(exp) && lisp_object_count() == l + 4 && "test_region() :: allocations go to the arena");
+    exp = lisp_region_end(exp);
+    assert_ctr(!lisp_arenap(exp) && lisp_length(exp) == 3 && lisp_eq(cadr(exp), "b") && symbolp(car(caddr(exp))) &&
+               "test_region() :: the kept value is evacuated");
+    prog = "x";
+    assert_ctr(lisp_eq(eval(lisp_read(&prog), global_env), "five") && "test_region() :: assignments are evacuated");
+    prog = "(sq 7)";
+    assert_ctr(fixnum(eval(lisp_read(&prog), global_env)) == 49 && "test_region() :: definitions are evacuated");
+
+    // Once the arena is full allocation carries on in the pages, roots are evacuated
+    lisp_region_begin();
+    for (int i = 0; i < overflow; ++i) kept = cons(mkstring("s"), kept);
+    lisp_region_end(nil);
+    for (c = kept; !nullp(c) && !lisp_arenap(c) && !lisp_arenap(car(c)) && lisp_eq(car(c), "s"); c = cdr(c));
+    assert_ctr(nullp(c) && lisp_length(kept) == overflow && "test_region() :: arena overflow and roots");
+
+    // Stores into more old cells than the remembered set holds
+    lisp_sweep();
+    lisp_region_begin();
+    for (c = kept; !nullp(c); c = cdr(c)) setcarb(c, mkstring("r"));
+    lisp_region_end(nil);
+    for (c = kept; !nullp(c) && !lisp_arenap(car(c)) && lisp_eq(car(c), "r"); c = cdr(c));
+    assert_ctr(nullp(c) && "test_region() :: an overflowing remembered set falls back to a heap scan");
+
+    // Arena cells shaded once the mark stack is full are rescanned, the strings they hold are not swept
+    c = nil;
+    for (int i = 0; i < LISP_MARK_STACK * 2; ++i) c = cons(mkstring("old"), c);
+    lisp_region_begin();
+    for (exp = nil; !nullp(c); c = cdr(c)) exp = cons(car(c), exp);
+    lisp_gc_root(&exp);
+    lisp_gc_step(1);
+    for (c = exp; !nullp(c); c = cdr(c)) setcarb(kept, c);
+    while (!lisp_gc_step(10));
+    for (c = exp; !nullp(c) && lisp_eq(car(c), "old"); c = cdr(c));
+    assert_ctr(lisp_arenap(exp) && nullp(c) && "test_region() :: arena cells overflowing the mark stack are rescanned");
+    lisp_gc_unroot(&exp);
+    lisp_region_end(nil);
+
+    lisp_gc_unroot(&kept);
+    lisp_cleanup();
+}
+
+void test_quota() {
+    cell exp, form;
+    const char *prog;
+    char message[3 * MAXLEN];
+
+    lisp_init();
+    prog = "(define (grow n acc) (if (= n 0) acc (grow (- n 1) (+ acc 1))))";
+    eval(lisp_read(&prog), global_env);
+    prog = "(grow 1 0)";
+    eval(lisp_read(&prog), global_env);     // Address the body outside the quota
+
+    assert_ctr(lisp_quota_begin(1000, 8 * 1024) && !lisp_quota_begin(1000, 1000) && !lisp_region_begin() &&
+               "test_quota() :: quotas are regions and do not nest");
+    prog = "(grow 10 0)";
+    exp = eval(lisp_read(&prog), global_env);
+    assert_ctr(lisp_quota_used().cells > 10 && lisp_quota_used().bytes >= lisp_quota_used().cells * sizeof(lisp_cell) &&
+               "test_quota() :: allocations are counted");
+    exp = lisp_quota_end(exp);
+    assert_ctr(fixnum(exp) == 10 && !lisp_arenap(exp) && "test_quota() :: within the quota");
+
+    size_t l = lisp_object_count();
+    lisp_quota_begin(50, SIZE_MAX);
+    prog = "(grow 1000 0)";
+    exp = eval(lisp_read(&prog), global_env);
+    assert_ctr(errorp(exp) && lisp_quota_used().cells > 50 && "test_quota() :: too many cells");
+    exp = lisp_quota_end(exp);
+    assert_ctr(errorp(exp) && lisp_object_count() == l + 1 && "test_quota() :: reclaimed in one go, but the ERROR");
+
+    lisp_quota_begin(SIZE_MAX, 40 * sizeof(lisp_cell));
+    prog = "(+ 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30)";
+    exp = lisp_quota_end(eval(lisp_read(&prog), global_env));
+    assert_ctr(errorp(exp) && "test_quota() :: too many bytes for the arguments");
+
+    memset(message, 'x', sizeof message);
+    message[0] = '"';
+    message[sizeof message - 2] = '"';
+    message[sizeof message - 1] = 0;
+    lisp_quota_begin(SIZE_MAX, 2 * MAXLEN);
+    prog = message;
+    exp = lisp_quota_end(lisp_read(&prog));
+    assert_ctr(errorp(exp) && "test_quota() :: a string growing the reader's buffer");
+    lisp_quota_begin(SIZE_MAX, 8 * MAXLEN);
+    prog = message;
+    exp = lisp_quota_end(lisp_read(&prog));
+    assert_ctr(lisp_typeof(exp) == STRING && strlen(exp->string) == sizeof message - 3 && "test_quota() :: the same string allowed");
+
+    // Analysis and bytecode are charged, their cells as well as the trees and words from outside the pages
+    prog = "(grow 10 (+ 1 2))";
+    form = lisp_read(&prog);
+    lisp_quota_begin(SIZE_MAX, SIZE_MAX);
+    exp = lisp_analyze(form);
+    assert_ctr(lisp_quota_used().bytes >= lisp_quota_used().cells * sizeof(lisp_cell) + sizeof(lisp_node) &&
+               "test_quota() :: analysis is charged");
+    exp = lisp_quota_end(exp);
+    lisp_quota_begin(SIZE_MAX, SIZE_MAX);
+    exp = lisp_compile(form);
+    assert_ctr(lisp_quota_used().bytes >= lisp_quota_used().cells * sizeof(lisp_cell) + sizeof(lisp_code) &&
+               "test_quota() :: bytecode is charged");
+    exp = lisp_quota_end(exp);
+    assert_ctr(fixnum(lisp_run(exp, global_env)) == 13 && "test_quota() :: kept");
+    lisp_quota_begin(SIZE_MAX, sizeof(lisp_code));
+    exp = lisp_quota_end(lisp_compile(form));
+    assert_ctr(errorp(exp) && "test_quota() :: too many bytes for the bytecode");
+
+    // Running out of arena is running out of quota, a larger byte limit is clamped to it. A message is not
+    // undone: the define before it stays
+    lisp_quota_begin(SIZE_MAX, LISP_REGION_BYTES * 16);
+    prog = "(begin (define y 1) (grow 100000 0))";
+    exp = lisp_quota_end(eval(lisp_read(&prog), global_env));
+    prog = "y";
+    assert_ctr(errorp(exp) && fixnum(eval(lisp_read(&prog), global_env)) == 1 && "test_quota() :: the arena is the limit");
+    prog = "(grow 10 0)";
+    assert_ctr(fixnum(eval(lisp_read(&prog), global_env)) == 10 && "test_quota() :: evaluating afterwards");
+
+    lisp_cleanup();
+}
+
+void test_static_heap() {
+#ifdef WITH_STATIC_HEAP
+    static char tight[48 * 1024];
+    static char big[64 * 1024];
+    cell exp;
+    const char *prog;
+
+    (lisp_init)(tight, sizeof tight);   // Not the suite's macro, that would hand over the big heap
+    prog = STR(
+            (define (factorial n)
+                (if (= n 1)
+                    1
+                    (* n (factorial (- n 1)))))
+    );
+    eval(lisp_read(&prog), global_env);
+    prog = STR((define (count n) (if (= n 0) 0 (+ 1 (count (- n 1))))));
+    eval(lisp_read(&prog), global_env);
+    prog = "(factorial 10)";
+    assert_ctr(fixnum(eval(lisp_read(&prog), global_env)) == 3628800 && "test_static_heap() :: evaluates in the block");
+
+    prog = "(count 100000)";
+    exp = eval(lisp_read(&prog), global_env);
+    assert_ctr(errorp(exp) && lisp_eq(exp, "Out of memory") && "test_static_heap() :: exhaustion is an ERROR");
+
+    lisp_sweep();
+    prog = "(count 10)";
+    exp = eval(lisp_read(&prog), global_env);
+    assert_ctr(fixnum(exp) == 10 && "test_static_heap() :: usable again once collected");
+
+    // Strings come from the block too
+    memset(big, 'a', sizeof big - 1);
+    big[0] = '"';
+    prog = big;
+    exp = lisp_read(&prog);
+    assert_ctr(errorp(exp) && "test_static_heap() :: the reader runs out of memory");
+    assert_ctr(!lisp_region_begin() && "test_static_heap() :: no room for a region arena");
+
+    lisp_sweep();
+    prog = "(define x \"still here\")";
+    eval(lisp_read(&prog), global_env);
+    prog = "(factorial 5)";
+    exp = eval(lisp_read(&prog), global_env);
+    assert_ctr(fixnum(exp) == 120 && "test_static_heap() :: the interpreter is still usable");
+    prog = "x";
+    assert_ctr(lisp_eq(eval(lisp_read(&prog), global_env), "still here") && "test_static_heap() :: definitions survive");
+
+    lisp_cleanup();
+#endif
+}
+
+void test_immediates() {
+    cell exp;
+    lisp_init();
+
+    exp = mkchar('a');
+    assert_ctr(lisp_typeof(exp) == CHAR && "test_immediates() :: returns a CHAR object");
+    assert_ctr(character(exp) == 'a' && "test_immediates() :: returns value a");
+    assert_ctr(lisp_equals(exp, mkchar('a')) && "test_immediates() :: like characters are equivalent");
+    assert_ctr(!lisp_equals(exp, mkchar('b')) && "test_immediates() :: unlike characters are not equivalent");
+
+    assert_ctr(fixnum(mkfixnum(-42)) == -42 && "test_immediates() :: negative fixnums");
+    assert_ctr(fixnum(mkfixnum(LONG_MAX)) == LONG_MAX && "test_immediates() :: large fixnums are kept whole");
+    assert_ctr(fixnum(mkfixnum(LONG_MIN)) == LONG_MIN && "test_immediates() :: large fixnums are kept whole");
+    assert_ctr(lisp_equals(mkfixnum(LONG_MAX), mkfixnum(LONG_MAX)) && "test_immediates() :: large fixnums compare");
+
+    assert_ctr(lisp_typeof(nil) == NIL && "test_immediates() :: nil is NIL");
+    assert_ctr(nullp(car(nil)) && nullp(cdr(nil)) && "test_immediates() :: car and cdr of nil is nil");
+    assert_ctr(symbolp(lisp_true) && lisp_eq(lisp_true, T) && "test_immediates() :: true is the symbol T");
+
+#ifdef WITH_TAGGED_IMMEDIATES
+    const char *ptr = "(+ 1 2)";
+    exp = lisp_read(&ptr);
+    size_t l = lisp_object_count();
+    exp = eval(exp, global_env);
+    assert_ctr(fixnum(exp) == 3 && "test_immediates() :: immediate arithmetic");
+    assert_ctr(lisp_object_count() == l + 2 && "test_immediates() :: only the argument list is allocated");
+    assert_ctr(fixnum(nil) == 0 && character(nil) == 0 && "test_immediates() :: nil read as a number is 0");
+    ptr = "(-)";
+    assert_ctr(fixnum(eval(lisp_read(&ptr), global_env)) == 0 && "test_immediates() :: arithmetic without arguments");
+#endif
 
     lisp_cleanup();
 }
@@ -607,7 +1701,7 @@ void test_lisp_float() {
 
     ptr = "3.3";
     exp = lisp_read(&ptr);
-    assert_ctr(exp -> type == FLOAT && "test_lisp_floater() :: returns a FLOAT object");
+    assert_ctr(lisp_typeof(exp) == FLOAT && "test_lisp_floater() :: returns a FLOAT object");
     assert_ctr(floater(exp) == 3.3 && "test_lisp_floater() :: returns value 3.3");
 
     lisp_cleanup();
@@ -623,27 +1717,27 @@ void test_lisp_quote() {
 
     ptr = "'A";
     exp = lisp_read(&ptr);
-    assert_ctr(car(exp) -> type == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
+    assert_ctr(lisp_typeof(car(exp)) == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
     assert_ctr(lisp_eq(car(exp), "quote") && "test_lisp_quote() :: Symbol should be a quote");
-    assert_ctr(cadr(exp) -> type == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
+    assert_ctr(lisp_typeof(cadr(exp)) == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
     assert_ctr(lisp_eq(cadr(exp),"A") && "test_lisp_quote() :: Parsing should not be finished");
 
     ptr = "'(A)";
     exp = lisp_read(&ptr);
-    assert_ctr(car(exp) -> type == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
+    assert_ctr(lisp_typeof(car(exp)) == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
     assert_ctr(lisp_eq(car(exp), "quote") && "test_lisp_quote() :: Symbol should be a quote");
     assert_ctr(listp(cadr(exp)));
-    assert_ctr(caadr(exp) -> type == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
+    assert_ctr(lisp_typeof(caadr(exp)) == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
     assert_ctr(lisp_eq(caadr(exp),"A") && "test_lisp_quote() :: Parsing should not be finished");
 
     ptr = "'(A A)";
     exp = lisp_read(&ptr);
-    assert_ctr(car(exp) -> type == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a a)");
+    assert_ctr(lisp_typeof(car(exp)) == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a a)");
     assert_ctr(lisp_eq(car(exp), "quote") && "test_lisp_quote() :: Symbol should be a quote");
     assert_ctr(listp(cadr(exp)));
-    assert_ctr(caadr(exp) -> type == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a a)");
+    assert_ctr(lisp_typeof(caadr(exp)) == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a a)");
     assert_ctr(lisp_eq(caadr(exp),"A") && "test_lisp_quote() :: Parsing should not be finished");
-    assert_ctr(cadadr(exp) -> type == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a a)");
+    assert_ctr(lisp_typeof(cadadr(exp)) == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a a)");
     assert_ctr(lisp_eq(cadadr(exp),"A") && "test_lisp_quote() :: Parsing should not be finished");
 
     ptr = "('A 'B)";
@@ -651,15 +1745,15 @@ void test_lisp_quote() {
     assert_ctr(listp(car(exp)));
 
     exp1 = car(exp);
-    assert_ctr(car(exp1) -> type == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
+    assert_ctr(lisp_typeof(car(exp1)) == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
     assert_ctr(lisp_eq(car(exp1), "quote") && "test_lisp_quote() :: Symbol should be a quote");
-    assert_ctr(cadr(exp1) -> type == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
+    assert_ctr(lisp_typeof(cadr(exp1)) == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
     assert_ctr(lisp_eq(cadr(exp1), "A") && "test_lisp_quote() :: Symbol should be a quote");
 
     exp1 = cadr(exp);
-    assert_ctr(car(exp1) -> type == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
+    assert_ctr(lisp_typeof(car(exp1)) == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
     assert_ctr(lisp_eq(car(exp1), "quote") && "test_lisp_quote() :: Symbol should be a quote");
-    assert_ctr(cadr(exp1) -> type == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
+    assert_ctr(lisp_typeof(cadr(exp1)) == SYM && "test_lisp_quote() :: should return a quoted symbol (quote a)");
     assert_ctr(lisp_eq(cadr(exp1), "B") && "test_lisp_quote() :: Symbol should be a quote");
 
     lisp_cleanup();
@@ -672,7 +1766,7 @@ void test_lisp_strings() {
 
     ptr = "\"a string\"";
     exp = lisp_read(&ptr);
-    assert_ctr(exp -> type == STRING && "test_lisp_string() :: returns a STRING object");
+    assert_ctr(lisp_typeof(exp) == STRING && "test_lisp_string() :: returns a STRING object");
     assert_ctr(lisp_eq(exp, "a string") && "test_lisp_string() :: string should have spaces");
 
     ptr = "\"a (string)\"";
@@ -702,12 +1796,12 @@ void test_lisp_symbol() {
 
     ptr = "A";
     exp1 = lisp_read(&ptr);
-    assert_ctr(exp1 -> type == SYM && "test_lisp_symbol() :: returns a SYM object");
+    assert_ctr(lisp_typeof(exp1) == SYM && "test_lisp_symbol() :: returns a SYM object");
     assert_ctr(lisp_eq(exp1, (any) "A") && "test_lisp_symbol() :: returns value A");
 
     ptr = "ABCD";
     exp1 = lisp_read(&ptr);
-    assert_ctr(exp1 -> type == SYM && "test_lisp_symbol() :: returns a SYM object");
+    assert_ctr(lisp_typeof(exp1) == SYM && "test_lisp_symbol() :: returns a SYM object");
     assert_ctr(lisp_eq(exp1, (any) "ABCD") && "test_lisp_symbol() :: multiple chars returns value ABCD");
 
     ptr = "XYZ"; ptr2 = "XYZ";
@@ -730,17 +1824,17 @@ void test_lisp_fixnum() {
 
     ptr = "3";
     exp = lisp_read(&ptr);
-    assert_ctr(exp -> type == FIXNUM && "test_lisp_fixnum() :: returns a FIXNUM object");
+    assert_ctr(lisp_typeof(exp) == FIXNUM && "test_lisp_fixnum() :: returns a FIXNUM object");
     assert_ctr(fixnum(exp) == 3 && "test_lisp_fixnum() :: returns value 3");
 
     ptr = "  4  ";
     exp = lisp_read(&ptr);
-    assert_ctr(exp -> type == FIXNUM && "test_lisp_fixnum() :: with padded spaces returns a FIXNUM object");
+    assert_ctr(lisp_typeof(exp) == FIXNUM && "test_lisp_fixnum() :: with padded spaces returns a FIXNUM object");
     assert_ctr(fixnum(exp) == 4 && "test_lisp_fixnum() :: with padded spaces returns value 4");
 
     ptr = "5432";
     exp = lisp_read(&ptr);
-    assert_ctr(exp -> type == FIXNUM && "test_lisp_fixnum() :: several digits returns a FIXNUM object");
+    assert_ctr(lisp_typeof(exp) == FIXNUM && "test_lisp_fixnum() :: several digits returns a FIXNUM object");
     assert_ctr(fixnum(exp) == 5432 && "test_lisp_fixnum() :: several digits returns value 4");
 
     lisp_cleanup();
@@ -766,7 +1860,7 @@ void test_basic_nil() {
 void test_rest_nil() {
     lisp_init();
     cell exp = mksym("TEST");
-    assert_ctr(nullp(exp->rest) && "test_rest_nil() :: The last element of a list should always be nil");
+    assert_ctr(nullp(rest(exp)) && "test_rest_nil() :: The last element of a list should always be nil");
     lisp_cleanup();
 }
 
@@ -800,16 +1894,16 @@ void test_lisp_list() {
     assert_ctr(listp(exp1) && "test_lisp_list :: Read a basic list");
     assert_ctr(lisp_length(exp1) == 3 && "test_lisp_list :: Basic list length should be 3");
 
-    assert_ctr(car(exp1)->type == FIXNUM && "test_lisp_list :: Element 1 should be a fixnum");
+    assert_ctr(lisp_typeof(car(exp1)) == FIXNUM && "test_lisp_list :: Element 1 should be a fixnum");
     assert_ctr(fixnum(first(exp1)) == 1 && "test_lisp_list :: Element 1 should be 1");
 
-    assert_ctr(second(exp1)->type == FIXNUM && "test_lisp_list :: Element 2 should be a fixnum");
+    assert_ctr(lisp_typeof(second(exp1)) == FIXNUM && "test_lisp_list :: Element 2 should be a fixnum");
     assert_ctr(fixnum(second(exp1)) == 2 && "test_lisp_list :: Element 2 should be 2");
 
-    assert_ctr(third(exp1)->type == FIXNUM && "test_lisp_list :: Element 3 should be a fixnum");
+    assert_ctr(lisp_typeof(third(exp1)) == FIXNUM && "test_lisp_list :: Element 3 should be a fixnum");
     assert_ctr(fixnum(third(exp1)) == 3 && "test_lisp_list :: Element 3 should be 3");
 
-    assert_ctr(nth(exp1,2)->type == FIXNUM && "test_lisp_list :: Test nth 2 returns 2nd element");
+    assert_ctr(lisp_typeof(nth(exp1,2)) == FIXNUM && "test_lisp_list :: Test nth 2 returns 2nd element");
     assert_ctr(fixnum(nth(exp1,2)) == 2 && "test_lisp_list :: Test nth 2 returns 2nd element");
 
 //    lisp_pprint(exp1,0);
@@ -847,7 +1941,7 @@ void test_eval_assignment() {
 
     exp = mklist(3, mksym("set!"), v, mkfixnum(10));
     result = eval(exp, global_env);
-    assert_ctr(result->type == ERROR && "Cannot assign unbound variable");
+    assert_ctr(lisp_typeof(result) == ERROR && "Cannot assign unbound variable");
 
     define_variableb(v, mkfixnum(42), global_env);
     result = lookup_variable_value(v, global_env);
@@ -855,7 +1949,7 @@ void test_eval_assignment() {
 
     exp = mklist(3, mksym("set!"), v, mkfixnum(101));
     result = eval(exp, global_env);
-    assert_ctr(result->type != ERROR && "Cannot assign unbound variable");
+    assert_ctr(lisp_typeof(result) != ERROR && "Cannot assign unbound variable");
     result = lookup_variable_value(v, global_env);
     assert_ctr( lisp_equals(result, mkfixnum(101)) && "Var x updated to 101");
     lisp_cleanup();
@@ -899,6 +1993,565 @@ void test_eval_if() {
     lisp_cleanup();
 }
 
+#define eval_str(S)     (prog = (S), eval(lisp_read(&prog), global_env))
+
+void test_lexical_addressing() {
+    cell exp, body;
+    const char *prog;
+    lisp_init();
+
+    eval_str("(define (f x y) (+ x y))");
+    exp = eval_str("f");
+    body = car(procedure_body(exp));
+    assert_ctr(lexicalp(cadr(body)) && lexical_depth(cadr(body)) == 0 && lexical_slot(cadr(body)) == 0 &&
+               lexical_name(cadr(body)) == mksym("x") && "test_lexical_addressing() :: first parameter");
+    assert_ctr(lexicalp(caddr(body)) && lexical_depth(caddr(body)) == 0 && lexical_slot(caddr(body)) == 1 &&
+               "test_lexical_addressing() :: second parameter");
+    assert_ctr(lexicalp(car(body)) && lexical_depth(car(body)) == 1 && lexical_slot(car(body)) == LEXICAL_FREE &&
+               "test_lexical_addressing() :: globals are free");
+    assert_ctr(fixnum(eval_str("(f 40 2)")) == 42 && "test_lexical_addressing() :: addressed procedures evaluate");
+
+    // Closures reach out to the frames of enclosing lambdas
+    eval_str("(define (adder n) (lambda (x) (+ x n)))");
+    assert_ctr(fixnum(eval_str("((adder 3) 4)")) == 7 && "test_lexical_addressing() :: enclosing frames");
+    body = car(procedure_body(eval_str("(adder 0)")));
+    assert_ctr(lexical_depth(caddr(body)) == 1 && lexical_slot(caddr(body)) == 0 &&
+               lexical_depth(car(body)) == 2 && lexical_slot(car(body)) == LEXICAL_FREE &&
+               "test_lexical_addressing() :: nested lambdas are addressed with the enclosing one");
+    eval_str("(define (counter n) (lambda () (set! n (+ n 1)) n))");
+    eval_str("(define next (counter 10))");
+    eval_str("(next)");
+    assert_ctr(fixnum(eval_str("(next)")) == 12 && "test_lexical_addressing() :: assignment to an addressed variable");
+    eval_str("(define total 0)");
+    eval_str("(define (add! x) (set! total (+ total x)))");
+    eval_str("(add! 5)");
+    assert_ctr(fixnum(eval_str("total")) == 5 && "test_lexical_addressing() :: assignment to a free variable");
+
+    // Internal definitions keep their frame's references symbolic
+    eval_str("(define (g x) (define y (* x 2)) (+ x y))");
+    assert_ctr(fixnum(eval_str("(g 5)")) == 15 && "test_lexical_addressing() :: internal definitions");
+    body = car(cdr(procedure_body(eval_str("g"))));
+    assert_ctr(symbolp(cadr(body)) && symbolp(caddr(body)) && "test_lexical_addressing() :: a defining frame is not addressed");
+
+    // Data and special forms are left alone
+    exp = eval_str("((lambda (x) '(x y)) 1)");
+    assert_ctr(car(exp) == mksym("x") && "test_lexical_addressing() :: quoted data is not addressed");
+    eval_str("(define (sign x) (begin (if (= x 0) 0 (if (= x 1) 1 (- 0 1)))))");
+    assert_ctr(fixnum(eval_str("(sign 0)")) == 0 && fixnum(eval_str("(sign 1)")) == 1 &&
+               fixnum(eval_str("(sign 2)")) == -1 && "test_lexical_addressing() :: if and begin");
+    eval_str("(define (shadow +) (+ 1 2))");
+    assert_ctr(fixnum(eval_str("(shadow *)")) == 2 && "test_lexical_addressing() :: parameters shadow globals");
+
+    lisp_cleanup();
+}
+
+void test_frames() {
+    cell vars, env, exp, next;
+    const char *prog;
+    lisp_init();
+
+    vars = mklist(2, mksym("a"), mksym("b"));
+    env = extend_environment(vars, mklist(2, mkfixnum(1), mkfixnum(2)), global_env);
+    assert_ctr(framep(env) && first_frame(env) == env && enclosing_environment(env) == global_env &&
+               "test_frames() :: a call's frame is one cell in front of the environment");
+    assert_ctr(frame_vector(env)->count == 2 && fixnum(frame_slot(env, 0)) == 1 && fixnum(frame_slot(env, 1)) == 2 &&
+               frame_vector(env)->names == vars && "test_frames() :: the values in slots, named by the parameter list");
+    assert_ctr(errorp(extend_environment(vars, mklist(1, mkfixnum(1)), global_env)) &&
+               errorp(extend_environment(vars, mklist(3, mkfixnum(1), mkfixnum(2), mkfixnum(3)), global_env)) &&
+               "test_frames() :: arity is checked");
+    assert_ctr(framep(extend_environment(nil, nil, global_env)) && "test_frames() :: a call without parameters");
+
+    // Defining grows the frame, the parameter list it shares is left alone
+    for (int i = 0; i < 20; ++i) {
+        char name[8];
+        sprintf(name, "d%d", i);
+        define_variableb(mksym(name), mkfixnum(i), env);
+    }
+    define_variableb(mksym("a"), mkfixnum(10), env);
+    assert_ctr(frame_vector(env)->count == 22 && frame_vector(env)->size >= 22 && lisp_length(vars) == 2 &&
+               fixnum(lookup_variable_value(mksym("d19"), env)) == 19 &&
+               fixnum(lookup_variable_value(mksym("a"), env)) == 10 && "test_frames() :: definitions grow the frame");
+    set_variable_valueb(mksym("d3"), mkfixnum(-3), env);
+    assert_ctr(fixnum(lookup_variable_value(mksym("d3"), env)) == -3 &&
+               fixnum(lookup_variable_value(mksym("+"), env)) != 0 && "test_frames() :: assignment and lookup outwards");
+
+    // Closures keep their frames through every kind of collection
+    eval_str("(define (counter n) (lambda () (set! n (+ n 1)) n))");
+    next = eval_str("(counter 0)");
+    lisp_gc_root(&next);
+    lisp_gc_minor();
+    exp = mklist(1, quote(next));
+    assert_ctr(fixnum(eval(exp, global_env)) == 1 && "test_frames() :: frames are promoted");
+    lisp_sweep();
+    lisp_compact();
+    exp = mklist(1, quote(next));
+    assert_ctr(fixnum(eval(exp, global_env)) == 2 && "test_frames() :: frames are compacted");
+    lisp_region_begin();
+    next = eval_str("(counter 100)");
+    exp = mklist(1, quote(next));
+    eval(exp, global_env);
+    lisp_region_end(nil);
+    exp = mklist(1, quote(next));
+    assert_ctr(fixnum(eval(exp, global_env)) == 102 && "test_frames() :: frames made in a region");
+    eval_str("(define (keep x) (define y 20) (define z 300) (lambda () (+ x y z)))");
+    lisp_region_begin();
+    next = eval_str("(keep 1)");
+    eval_str("(keep 2)");
+    lisp_region_end(nil);
+    exp = mklist(1, quote(next));
+    assert_ctr(fixnum(eval(exp, global_env)) == 321 && "test_frames() :: frames grown in a region");
+    lisp_gc_unroot(&next);
+
+    lisp_cleanup();
+}
+
+void test_inline_cache() {
+    cell body;
+    lisp_cache_stats stats;
+    const char *prog;
+    lisp_init();
+
+    eval_str("(define k 1)");
+    eval_str("(define (get-k) k)");
+    eval_str("(get-k)");
+    lisp_inline_cache_reset();
+    for (int i = 0; i < 10; ++i) eval_str("(get-k)");
+    stats = lisp_inline_cache_stats();
+    assert_ctr(stats.hits == 10 && stats.misses == 0 && "test_inline_cache() :: repeated references hit");
+    body = car(procedure_body(eval_str("get-k")));
+    assert_ctr(lexicalp(body) && lexical_freep(body) && lexical_name(body) == mksym("k") &&
+               fixnum(cdr(cdr(body))) == 1 && "test_inline_cache() :: the value is held by the reference");
+
+    // Every way of changing a global empties the caches holding it
+    eval_str("(set! k 2)");
+    assert_ctr(fixnum(eval_str("(get-k)")) == 2 && "test_inline_cache() :: assignment");
+    eval_str("(define k 3)");
+    assert_ctr(fixnum(eval_str("(get-k)")) == 3 && "test_inline_cache() :: redefinition");
+    eval_str("(define (set-k v) (set! k v))");
+    eval_str("(set-k 4)");
+    assert_ctr(fixnum(eval_str("(get-k)")) == 4 && "test_inline_cache() :: assignment from a procedure");
+    add_binding_to_frameb(mksym("k"), mkfixnum(5), first_frame(global_env));
+    assert_ctr(fixnum(eval_str("(get-k)")) == 5 && "test_inline_cache() :: a shadowing binding");
+    lisp_gc_minor();
+    lisp_compact();
+    lisp_inline_cache_reset();
+    assert_ctr(fixnum(eval_str("(get-k)")) == 5 && "test_inline_cache() :: collections");
+    eval_str("(get-k)");
+    stats = lisp_inline_cache_stats();
+    assert_ctr(stats.hits == 1 && stats.misses == 1 && "test_inline_cache() :: refilled after a collection");
+
+    // Primitives are globals like any other
+    eval_str("(define (inc x) (+ x 1))");
+    assert_ctr(fixnum(eval_str("(inc 1)")) == 2 && fixnum(eval_str("(inc 2)")) == 3 && "test_inline_cache() :: primitives");
+    eval_str("(define + -)");
+    assert_ctr(fixnum(eval_str("(inc 3)")) == 2 && "test_inline_cache() :: a redefined primitive");
+
+    // Only a reference looked up in global_env uses its cache
+    cell env = extend_environment(mklist(1, mksym("n")), mklist(1, mkfixnum(7)), global_env);
+    eval_str("(define n 8)");
+    prog = "((lambda () n))";
+    body = lisp_read(&prog);
+    assert_ctr(fixnum(eval(body, global_env)) == 8 && fixnum(eval(body, env)) == 7 &&
+               fixnum(eval(body, global_env)) == 8 && "test_inline_cache() :: other environments look up by name");
+
+    lisp_cleanup();
+}
+
+#define execute_str(S)  (prog = (S), lisp_execute(lisp_analyze(lisp_read(&prog)), global_env))
+
+void test_analyze() {
+    cell node;
+    const char *prog;
+    lisp_init();
+
+    assert_ctr(fixnum(execute_str("42")) == 42 && "test_analyze() :: a constant");
+    assert_ctr(lisp_eq(execute_str("(quote y)"), "y") && "test_analyze() :: quote");
+    assert_ctr(fixnum(execute_str("(if 1 2 3)")) == 2 && fixnum(execute_str("(if false 2 3)")) == 3 &&
+               "test_analyze() :: if");
+    execute_str("(define x 10)");
+    assert_ctr(fixnum(execute_str("x")) == 10 && "test_analyze() :: define");
+    execute_str("(set! x 11)");
+    assert_ctr(fixnum(eval_str("x")) == 11 && "test_analyze() :: set! changes the same binding as eval");
+    assert_ctr(fixnum(execute_str("(begin 1 2 3)")) == 3 && "test_analyze() :: begin");
+    assert_ctr(fixnum(execute_str("((lambda (a b) (- a b)) 5 3)")) == 2 && "test_analyze() :: lambda");
+    execute_str("(define (adder n) (lambda (m) (+ n m)))");
+    execute_str("(define add2 (adder 2))");
+    assert_ctr(fixnum(execute_str("(add2 40)")) == 42 && fixnum(eval_str("(add2 1)")) == 3 &&
+               "test_analyze() :: closures, also applied by eval");
+    execute_str("(define (factorial n) (if (= n 1) 1 (* n (factorial (- n 1)))))");
+    assert_ctr(fixnum(execute_str("(factorial 10)")) == 3628800 && "test_analyze() :: recursion");
+    assert_ctr(nodep(procedure_body(eval_str("factorial"))) && "test_analyze() :: the body is analyzed");
+
+    execute_str("(define (pick n) (cond ((= n 0) 10) ((= n 1) 11) (else 12)))");
+    assert_ctr(fixnum(execute_str("(pick 0)")) == 10 && fixnum(execute_str("(pick 1)")) == 11 &&
+               fixnum(execute_str("(pick 5)")) == 12 && "test_analyze() :: cond");
+    assert_ctr(nullp(execute_str("(cond ((= 1 2) 3))")) && "test_analyze() :: cond without a match");
+    assert_ctr(errorp(execute_str("(cond (else 1) ((= 1 1) 2))")) && "test_analyze() :: else isn't last");
+    assert_ctr(errorp(execute_str("unbound")) && "test_analyze() :: an unbound variable");
+    assert_ctr(errorp(lisp_execute(nil, global_env)) && "test_analyze() :: only a NODE executes");
+
+    // Executing makes no decisions about syntax and conses nothing for them
+    prog = "(if 1 2 3)";
+    node = lisp_analyze(lisp_read(&prog));
+    size_t count = lisp_object_count();
+    for (int i = 0; i < 10; ++i) lisp_execute(node, global_env);
+    assert_ctr(lisp_object_count() == count && "test_analyze() :: executing an if allocates nothing");
+
+    // The tree holds on to its cells while the collectors move them
+    prog = "(if (= (factorial 5) 120) (quote (a b)) false)";
+    node = lisp_analyze(lisp_read(&prog));
+    lisp_gc_root(&node);
+    lisp_gc_minor();
+    lisp_compact();
+    lisp_sweep();
+    cell result = lisp_execute(node, global_env);
+    assert_ctr(lisp_eq(car(result), "a") && lisp_eq(cadr(result), "b") &&
+               "test_analyze() :: a NODE survives collections");
+    lisp_gc_unroot(&node);
+
+    lisp_cleanup();
+}
+
+void test_fold() {
+    cell node, value;
+    const char *prog;
+    lisp_init();
+
+    prog = "(* 1000 (+ 60 60))";
+    node = lisp_analyze(lisp_read(&prog));
+    value = lisp_execute(node, global_env);
+    assert_ctr(fixnum(value) == 120000 && "test_fold() :: nested calls");
+    size_t count = lisp_object_count();
+    assert_ctr(lisp_execute(node, global_env) == value && lisp_object_count() == count &&
+               "test_fold() :: the value is computed once");
+    assert_ctr(truep(execute_str("(= 2 (- 5 3))")) && nullp(execute_str("(= (/ 6 2) 2)")) && "test_fold() :: =");
+    assert_ctr(fixnum(execute_str("(if false (/ 1 0) 5)")) == 5 && "test_fold() :: a division by 0 is not folded");
+
+    // Literal predicates leave one branch
+    assert_ctr(fixnum(execute_str("(if 1 2 unbound)")) == 2 && fixnum(execute_str("(if (quote ()) unbound 3)")) == 3 &&
+               "test_fold() :: if");
+    assert_ctr(fixnum(execute_str("(cond ((quote ()) unbound) (2 (+ 1 2)) (else unbound))")) == 3 &&
+               "test_fold() :: cond");
+
+    // Operators that may not be the primitives
+    assert_ctr(fixnum(execute_str("((lambda (*) (* 2 3)) +)")) == 5 && "test_fold() :: a parameter");
+    execute_str("(define (g) (define * +) (* 2 3))");
+    assert_ctr(fixnum(execute_str("(g)")) == 5 && "test_fold() :: an internal definition");
+
+    lisp_gc_root(&node);
+    lisp_compact();
+    assert_ctr(fixnum(lisp_execute(node, global_env)) == 120000 && "test_fold() :: collections");
+
+    execute_str("(define (minutes) (* 60 (+ 1 1)))");
+    assert_ctr(fixnum(execute_str("(minutes)")) == 120 && "test_fold() :: in a body");
+    eval_str("(define + -)");
+    assert_ctr(fixnum(execute_str("(minutes)")) == 0 && fixnum(lisp_execute(node, global_env)) == 0 &&
+               "test_fold() :: a redefined primitive is called again");
+    eval_str("(define + (lambda (a b) 7))");
+    assert_ctr(fixnum(execute_str("(minutes)")) == 420 && fixnum(execute_str("(minutes)")) == 420 &&
+               "test_fold() :: a procedure is not folded");
+    lisp_gc_unroot(&node);
+
+    lisp_cleanup();
+}
+
+#define run_str(S)      (prog = (S), lisp_run(lisp_compile(lisp_read(&prog)), global_env))
+
+void test_compile() {
+    cell code;
+    const char *prog;
+    lisp_init();
+
+    assert_ctr(fixnum(run_str("42")) == 42 && "test_compile() :: a constant");
+    assert_ctr(lisp_eq(run_str("(quote y)"), "y") && "test_compile() :: quote");
+    assert_ctr(fixnum(run_str("(if 1 2 3)")) == 2 && fixnum(run_str("(if false 2 3)")) == 3 &&
+               nullp(run_str("(if false 2)")) && "test_compile() :: if");
+    run_str("(define x 10)");
+    assert_ctr(fixnum(run_str("x")) == 10 && "test_compile() :: define");
+    run_str("(set! x 11)");
+    assert_ctr(fixnum(eval_str("x")) == 11 && "test_compile() :: set! changes the same binding as eval");
+    assert_ctr(fixnum(run_str("(begin 1 2 3)")) == 3 && "test_compile() :: begin");
+    assert_ctr(fixnum(run_str("(+ (begin 1 2) (if 1 (* 2 3) 0) ((lambda (a b) (- a b)) 5 3))")) == 10 &&
+               "test_compile() :: values kept on the stack across calls and branches");
+    run_str("(define (adder n) (lambda (m) (+ n m)))");
+    run_str("(define add2 (adder 2))");
+    assert_ctr(fixnum(run_str("(add2 40)")) == 42 && fixnum(eval_str("(add2 1)")) == 3 &&
+               "test_compile() :: closures, also applied by eval");
+    run_str("(define (local a) (set! a (+ a 1)) a)");
+    assert_ctr(fixnum(run_str("(local 1)")) == 2 && "test_compile() :: assigning a parameter");
+
+    run_str("(define (pick n) (cond ((= n 0) 10) ((= n 1) (+ 10 1)) (else 12)))");
+    assert_ctr(fixnum(run_str("(pick 0)")) == 10 && fixnum(run_str("(pick 1)")) == 11 &&
+               fixnum(run_str("(pick 5)")) == 12 && "test_compile() :: cond");
+    assert_ctr(nullp(run_str("(cond ((= 1 2) 3))")) && "test_compile() :: cond without a match");
+    assert_ctr(errorp(lisp_compile(lisp_read((prog = "(cond (else 1) ((= 1 1) 2))", &prog)))) &&
+               "test_compile() :: else isn't last");
+    assert_ctr(errorp(run_str("unbound")) && errorp(run_str("(+ 1 (unbound))")) &&
+               "test_compile() :: an unbound variable");
+    assert_ctr(errorp(run_str("((lambda (a) a) 1 2)")) && errorp(run_str("((lambda (a b) a) 1)")) &&
+               "test_compile() :: arity");
+    assert_ctr(errorp(lisp_run(nil, global_env)) && "test_compile() :: only a CODE runs");
+
+    // Calls between compiled code and code eval runs, either way round
+    run_str("(define (factorial n) (if (= n 1) 1 (* n (factorial (- n 1)))))");
+    assert_ctr(codep(procedure_body(eval_str("factorial"))) && "test_compile() :: the body is compiled");
+    assert_ctr(fixnum(run_str("(factorial 10)")) == 3628800 && fixnum(eval_str("(factorial 6)")) == 720 &&
+               "test_compile() :: recursion");
+    eval_str("(define (twice n) (* 2 (factorial n)))");
+    run_str("(define (call-twice n) (+ 1 (twice n)))");
+    assert_ctr(fixnum(run_str("(call-twice 3)")) == 13 && "test_compile() :: compiled, evaluated, compiled");
+
+    // The machine keeps its callers on a stack of its own, the C stack is not used by either kind of call
+    run_str("(define (count n) (if (= n 0) 0 (+ 1 (count (- n 1)))))");
+    assert_ctr(fixnum(run_str("(count 200)")) == 200 && "test_compile() :: deep recursion");
+    run_str("(define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1))))");
+    assert_ctr(fixnum(run_str("(loop 200 0)")) == 200 && "test_compile() :: tail calls");
+    run_str("(define (fails n) (if (= n 0) (unbound) (+ 1 (fails (- n 1)))))");
+    assert_ctr(errorp(run_str("(fails 200)")) && fixnum(run_str("(count 200)")) == 200 &&
+               "test_compile() :: an error unwinds the machine");
+
+    // compile is a primitive, its result a value like any other that runs when applied
+    eval_str("(define fact5 (compile (quote (factorial 5))))");
+    assert_ctr(codep(eval_str("fact5")) && fixnum(eval_str("(fact5)")) == 120 && fixnum(run_str("(fact5)")) == 120 &&
+               "test_compile() :: the compile primitive");
+    assert_ctr(errorp(eval_str("(fact5 1)")) && "test_compile() :: compiled code takes no arguments");
+
+    // The constants are held on to while the collectors move them
+    prog = "(if (= (factorial 5) 120) (quote (a b)) false)";
+    code = lisp_compile(lisp_read(&prog));
+    lisp_gc_root(&code);
+    lisp_gc_minor();
+    lisp_compact();
+    lisp_sweep();
+    cell result = lisp_run(code, global_env);
+    assert_ctr(lisp_eq(car(result), "a") && lisp_eq(cadr(result), "b") &&
+               "test_compile() :: a CODE survives collections");
+    lisp_gc_unroot(&code);
+
+    // Arithmetic done in place still goes through the bindings of the primitives
+    run_str("(define (add a b) (+ a b))");
+    assert_ctr(fixnum(run_str("(add 3 2)")) == 5 && "test_compile() :: a primitive");
+    eval_str("(define + -)");
+    assert_ctr(fixnum(run_str("(add 3 2)")) == 1 && "test_compile() :: a redefined primitive");
+
+    lisp_cleanup();
+}
+
+/*
+ * A tail call goes round eval's loop rather than into another eval, so the C stack a loop uses does not
+ * grow with the number of times it goes round
+ */
+void test_tail_calls() {
+    const char *prog;
+    size_t shallow, deep;
+    lisp_init();
+
+    eval_str("(define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1))))");
+    lisp_stack_reset();
+    assert_ctr(fixnum(eval_str("(loop 10 0)")) == 10 && "test_tail_calls() :: if");
+    shallow = lisp_stack_high_water();
+    lisp_stack_reset();
+    assert_ctr(fixnum(eval_str("(loop 200 0)")) == 200 && "test_tail_calls() :: if");
+    deep = lisp_stack_high_water();
+    assert_ctr(shallow > 0 && deep == shallow && "test_tail_calls() :: if branches reuse the frame");
+
+    eval_str("(define (down n) (begin (+ n 1) (cond ((= n 0) 0) (else (down (- n 1))))))");
+    lisp_stack_reset();
+    eval_str("(down 10)");
+    shallow = lisp_stack_high_water();
+    lisp_stack_reset();
+    assert_ctr(fixnum(eval_str("(down 200)")) == 0 && "test_tail_calls() :: begin and cond");
+    deep = lisp_stack_high_water();
+    assert_ctr(deep == shallow && "test_tail_calls() :: begin and cond actions reuse the frame");
+
+    eval_str("(define (count n) (if (= n 0) 0 (+ 1 (count (- n 1)))))");
+    lisp_stack_reset();
+    eval_str("(count 10)");
+    shallow = lisp_stack_high_water();
+    lisp_stack_reset();
+    assert_ctr(fixnum(eval_str("(count 50)")) == 50 && "test_tail_calls() :: recursion");
+    deep = lisp_stack_high_water();
+    assert_ctr(deep > shallow && "test_tail_calls() :: a call that isn't in tail position still grows the stack");
+
+    assert_ctr(errorp(eval_str("(begin 1 (unbound) 2)")) && errorp(eval_str("(loop (unbound) 0)")) &&
+               "test_tail_calls() :: errors before the tail position");
+    assert_ctr(nullp(eval_str("(begin)")) && nullp(eval_str("((lambda ()))")) &&
+               "test_tail_calls() :: empty sequences");
+
+    lisp_cleanup();
+}
+
+#define ec_str(S)       (prog = (S), lisp_ec_eval(lisp_read(&prog), global_env))
+
+void test_explicit_control() {
+    const char *prog;
+    lisp_init();
+
+    assert_ctr(fixnum(ec_str("42")) == 42 && lisp_eq(ec_str("(quote y)"), "y") &&
+               "test_explicit_control() :: constants and quote");
+    assert_ctr(fixnum(ec_str("(if 1 2 3)")) == 2 && fixnum(ec_str("(if false 2 3)")) == 3 &&
+               nullp(ec_str("(if false 2)")) && "test_explicit_control() :: if");
+    ec_str("(define x 10)");
+    ec_str("(set! x (+ x 1))");
+    assert_ctr(fixnum(eval_str("x")) == 11 && "test_explicit_control() :: define and set!");
+    assert_ctr(fixnum(ec_str("(begin 1 2 3)")) == 3 && nullp(ec_str("(begin)")) &&
+               "test_explicit_control() :: begin");
+    assert_ctr(fixnum(ec_str("(+ (* 2 3) (- 10 (+ 1 2)) ((lambda (a b) (/ a b)) 8 4))")) == 15 &&
+               "test_explicit_control() :: nested applications");
+    ec_str("(define (adder n) (lambda (m) (+ n m)))");
+    ec_str("(define add2 (adder 2))");
+    assert_ctr(fixnum(ec_str("(add2 40)")) == 42 && fixnum(eval_str("(add2 1)")) == 3 &&
+               "test_explicit_control() :: closures, also applied by eval");
+    ec_str("(define (id x) x)");
+    ec_str("(define (curry a) (lambda (b) (lambda (c) (+ a b c))))");
+    assert_ctr(fixnum(ec_str("(((curry 1) 2) 3)")) == 6 && fixnum(ec_str("((car (list (lambda (x) x))) 5)")) == 5 &&
+               fixnum(ec_str("((id id) 5)")) == 5 && "test_explicit_control() :: an application as the operator");
+    ec_str("(define (local a) (set! a (+ a 1)) a)");
+    assert_ctr(fixnum(ec_str("(local 1)")) == 2 && "test_explicit_control() :: assigning a parameter");
+    ec_str("(define (pick n) (cond ((= n 0) 10) ((= n 1) 11) (else 12)))");
+    assert_ctr(fixnum(ec_str("(pick 0)")) == 10 && fixnum(ec_str("(pick 1)")) == 11 &&
+               fixnum(ec_str("(pick 5)")) == 12 && "test_explicit_control() :: cond");
+    assert_ctr(errorp(ec_str("unbound")) && errorp(ec_str("(+ 1 (unbound))")) && errorp(ec_str("(1 2)")) &&
+               "test_explicit_control() :: errors");
+    assert_ctr(errorp(ec_str("((lambda (a) a) 1 2)")) && "test_explicit_control() :: arity");
+
+    // Procedures made by any of the evaluators can be applied by the machine
+    eval_str("(define (twice n) (* 2 n))");
+    run_str("(define (thrice n) (* 3 n))");
+    assert_ctr(fixnum(ec_str("(+ (twice 1) (thrice 2))")) == 8 && "test_explicit_control() :: mixed procedures");
+
+    // Recursion goes as deep as the stack in the heap allows, then fails with an ERROR
+    ec_str("(define (count n) (if (= n 0) 0 (+ 1 (count (- n 1)))))");
+    lisp_stack_reset();
+    assert_ctr(fixnum(ec_str("(count 200)")) == 200 && "test_explicit_control() :: deep recursion");
+    assert_ctr(lisp_stack_high_water() == 0 && "test_explicit_control() :: eval is not called");
+    ec_str("(define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1))))");
+    size_t limit = lisp_ec_max_depth(100);
+    assert_ctr(errorp(ec_str("(count 200)")) && fixnum(ec_str("(loop 200 0)")) == 200 &&
+               "test_explicit_control() :: a limit on recursion but not on tail calls");
+    lisp_ec_max_depth(limit);
+    assert_ctr(fixnum(ec_str("(count 10)")) == 10 && "test_explicit_control() :: after an error");
+
+    lisp_cleanup();
+}
+
+void test_eval_budget() {
+    lisp_eval_state state;
+    const char *prog;
+    cell exp, result;
+    size_t steps, ticks;
+    lisp_init();
+
+    prog = "(+ 1 2)";
+    result = lisp_eval_with_budget(lisp_read(&prog), global_env, 1000, &state);
+    assert_ctr(fixnum(result) == 3 && !lisp_suspendedp(&state) && state.steps > 0 && state.steps < 1000 &&
+               "test_eval_budget() :: finishing within the budget");
+
+    eval_str("(define (count n) (if (= n 0) 0 (+ 1 (count (- n 1)))))");
+    prog = "(count 50)";
+    exp = lisp_read(&prog);
+    lisp_gc_root(&exp);
+    result = lisp_eval_with_budget(exp, global_env, SIZE_MAX, &state);
+    steps = state.steps;
+    assert_ctr(fixnum(result) == 50 && !lisp_suspendedp(&state) && "test_eval_budget() :: an unlimited budget");
+
+    result = lisp_eval_with_budget(exp, global_env, 10, &state);
+    assert_ctr(lisp_suspendedp(&state) && result == state.machine && state.steps == 10 &&
+               "test_eval_budget() :: suspended when out of steps");
+    for (ticks = 1; lisp_suspendedp(&state); ++ticks) {
+        // Whatever else the host does between ticks, including collecting
+        lisp_gc_minor();
+        if (ticks % 16 == 0) {
+            lisp_compact();
+            lisp_sweep();
+        }
+        result = lisp_eval_resume(&state, 10);
+    }
+    assert_ctr(fixnum(result) == 50 && state.steps == steps && ticks == (steps + 9) / 10 &&
+               "test_eval_budget() :: resumed until finished, in the same steps");
+    lisp_gc_unroot(&exp);
+
+    // An operator that is itself a call, one step at a time
+    eval_str("(define (k a) (lambda (b) (+ a b)))");
+    prog = "((k 4) 1)";
+    result = lisp_eval_with_budget(lisp_read(&prog), global_env, 1, &state);
+    while (lisp_suspendedp(&state)) result = lisp_eval_resume(&state, 1);
+    assert_ctr(fixnum(result) == 5 && "test_eval_budget() :: an application as the operator");
+
+    prog = "(+ 1 (count 10) (unbound))";
+    result = lisp_eval_with_budget(lisp_read(&prog), global_env, 5, &state);
+    while (lisp_suspendedp(&state)) result = lisp_eval_resume(&state, 5);
+    assert_ctr(errorp(result) && "test_eval_budget() :: an error ends it");
+    assert_ctr(errorp(lisp_eval_resume(&state, 5)) && "test_eval_budget() :: nothing to resume");
+
+    prog = "(count 10)";
+    lisp_eval_with_budget(lisp_read(&prog), global_env, 5, &state);
+    lisp_eval_abandon(&state);
+    assert_ctr(!lisp_suspendedp(&state) && "test_eval_budget() :: abandoned");
+
+    lisp_cleanup();
+}
+
+void test_macros() {
+    const char *prog;
+    lisp_eval_state state;
+    cell body, result;
+    lisp_init();
+
+    assert_ctr(fixnum(eval_str("(car (cons 1 2))")) == 1 && fixnum(eval_str("(cdr (cons 1 2))")) == 2 &&
+               fixnum(eval_str("(car (cdr (list 1 2 3)))")) == 2 && errorp(eval_str("(car 1)")) &&
+               "test_macros() :: cons, car, cdr and list");
+
+    eval_str("(define expansions 0)");
+    eval_str("(define-macro (unless c a b) (set! expansions (+ expansions 1)) (list (quote if) c b a))");
+    assert_ctr(macrop(eval_str("unless")) && "test_macros() :: define-macro");
+    assert_ctr(fixnum(eval_str("(unless (= 1 2) 10 20)")) == 10 && fixnum(eval_str("(unless (= 1 1) 10 20)")) == 20 &&
+               "test_macros() :: a macro call");
+
+    // Expanded once for each place it is called from, however often that is evaluated
+    eval_str("(set! expansions 0)");
+    eval_str("(define (safe-div a b) (unless (= b 0) (/ a b) 0))");
+    assert_ctr(fixnum(eval_str("(safe-div 8 2)")) == 4 && fixnum(eval_str("(safe-div 8 0)")) == 0 &&
+               fixnum(eval_str("(safe-div 9 3)")) == 3 && fixnum(eval_str("expansions")) == 1 &&
+               "test_macros() :: expanded once per call site");
+    body = car(procedure_body(eval_str("safe-div")));
+    assert_ctr(car(body) == lisp_if && lexicalp(cadr(cadr(body))) && "test_macros() :: spliced into the body, then addressed");
+    eval_str("(define (shadow unless) (unless 5))");
+    assert_ctr(fixnum(eval_str("(shadow (lambda (x) (* x 2)))")) == 10 && "test_macros() :: a parameter is not the macro");
+
+    // Defined after the procedure calling it, expanded when the call is first evaluated
+    eval_str("(define (late n) (twice n))");
+    eval_str("(define-macro (twice x) (list (quote +) x x))");
+    assert_ctr(fixnum(eval_str("(late 4)")) == 8 && fixnum(eval_str("(late 5)")) == 10 && "test_macros() :: a later macro");
+    assert_ctr(fixnum(eval_str("(twice 7)")) == 14 && fixnum(eval_str("(twice (twice 1))")) == 4 &&
+               "test_macros() :: nested calls");
+    eval_str("(define-macro (seven) 7)");
+    assert_ctr(fixnum(eval_str("(seven)")) == 7 && "test_macros() :: an atom for an expansion");
+    assert_ctr(errorp(eval_str("(define-macro (bad x) (unbound))")) == false && errorp(eval_str("(bad 1)")) &&
+               errorp(eval_str("(define-macro not-a-procedure 1)")) && "test_macros() :: errors");
+
+    // cond is expanded in place, the ifs are made once
+    eval_str("(define (pick n) (cond ((= n 0) 10) ((= n 1) 11) (else 12)))");
+    assert_ctr(fixnum(eval_str("(pick 0)")) == 10 && fixnum(eval_str("(pick 1)")) == 11 &&
+               fixnum(eval_str("(pick 2)")) == 12 && "test_macros() :: cond");
+    body = car(procedure_body(eval_str("pick")));
+    assert_ctr(car(body) == lisp_if && car(cadddr(body)) == lisp_if && "test_macros() :: cond became nested ifs");
+
+    // The other evaluators expand the same macros
+    assert_ctr(fixnum(ec_str("(unless (= 1 2) (twice 3) 0)")) == 6 && "test_macros() :: explicit control");
+    prog = "(unless (= 1 2) ((car (list twice)) 3) 0)";
+    result = lisp_eval_with_budget(lisp_read(&prog), global_env, 1, &state);
+    while (lisp_suspendedp(&state)) result = lisp_eval_resume(&state, 1);
+    assert_ctr(fixnum(result) == 6 && "test_macros() :: explicit control, one step at a time");
+    assert_ctr(fixnum(execute_str("(unless (= 1 2) (twice 4) 0)")) == 8 && "test_macros() :: analyzed");
+    assert_ctr(fixnum(run_str("(unless (= 1 2) (twice 5) 0)")) == 10 && "test_macros() :: compiled");
+    run_str("(begin (define-macro (thrice x) (list (quote *) 3 x)) (define (nine) (thrice 3)))");
+    assert_ctr(fixnum(run_str("(nine)")) == 9 && fixnum(execute_str("(thrice 2)")) == 6 &&
+               "test_macros() :: defined as it is compiled");
+
+    lisp_cleanup();
+}
+
 void test_eval_lambda() {
     lisp_init();
     cell exp, result;
@@ -922,4 +2575,139 @@ void test_eval_begin() {
     assert_ctr( fixnum(result) == 42 && "begin returns last result of many expressions" );
 
     lisp_cleanup();
-}
\ No newline at end of file
+}
+
+/*
+ * Reading source full of known symbols, and looking up a global defined after a hundred others
+ */
+void bench_symbols() {
+    const int rounds = 20000;
+    clock_t t_start, t_end;
+    const char *prog;
+    char def[64];
+    cell exp;
+
+    lisp_init();
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        prog = "(define (walk lst acc) (if (null? lst) acc (walk (cdr lst) (+ acc (car lst)))))";
+        lisp_destroy_list(lisp_read(&prog));
+    }
+    stop_timer(t_end);
+    print_rate("Read 15 symbol definition", rounds, t_start, t_end);
+    printf("Objects after reading it %d times: %d\n", rounds, (int) lisp_object_count());
+
+    for (int i = 0; i < 100; ++i) {
+        sprintf(def, "(define global-variable-%d %d)", i, i);
+        prog = def;
+        eval(lisp_read(&prog), global_env);
+    }
+    prog = "global-variable-99";
+    exp = lisp_read(&prog);
+    start_timer(t_start);
+    for (int r = 0; r < rounds * 20; ++r) {
+        eval(exp, global_env);
+    }
+    stop_timer(t_end);
+    print_rate("Lookup of the 100th global", rounds * 20L, t_start, t_end);
+    lisp_cleanup();
+}
+
+/*
+ * What recognising an application costs: the string compares eval used to make for each special form,
+ * the same tests against interned symbols, and the switch on the operator's form. Then whole applications.
+ */
+#define tagged_namep(A, B)  (pairp(A) && symbolp(car(A)) && lisp_eq(car(A), B))
+
+void bench_dispatch() {
+    const int rounds = 1000000;
+    clock_t t_start, t_end;
+    const char *prog;
+    cell exps[4];
+    cell exp;
+    volatile int special = 0;
+
+    lisp_init();
+    prog = "((+ 1 2) (* 2 3) (- 3 4) (f 4 5))";
+    exp = lisp_read(&prog);
+    for (int i = 0; i < 4; ++i) exps[i] = nth(exp, i + 1);
+
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        exp = exps[r & 3];
+        if (tagged_namep(exp, QUOTE) || tagged_namep(exp, SETB) || tagged_namep(exp, DEFINE) ||
+            tagged_namep(exp, IF) || tagged_namep(exp, LAMBDA) || tagged_namep(exp, BEGIN) ||
+            tagged_namep(exp, COND)) special++;
+    }
+    stop_timer(t_end);
+    print_rate("Dispatch by name", rounds, t_start, t_end);
+
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        exp = exps[r & 3];
+        if (quotedp(exp) || assignmentp(exp) || definitionp(exp) || ifp(exp) || lambdap(exp) || beginp(exp) ||
+            condp(exp)) special++;
+    }
+    stop_timer(t_end);
+    print_rate("Dispatch by interned symbol", rounds, t_start, t_end);
+
+    start_timer(t_start);
+    for (int r = 0; r < rounds; ++r) {
+        exp = exps[r & 3];
+        if (special_form(car(exp)) != FORM_NONE) special++;
+    }
+    stop_timer(t_end);
+    print_rate("Dispatch by form", rounds, t_start, t_end);
+
+    exp = exps[0];
+    lisp_gc_root(&exp);
+    start_timer(t_start);
+    for (int r = 0; r < rounds / 10; ++r) {
+        eval(exp, global_env);
+        if ((r & 255) == 0) lisp_gc_minor();
+    }
+    stop_timer(t_end);
+    print_rate("Eval application (+ 1 2)", rounds / 10, t_start, t_end);
+    lisp_gc_unroot(&exp);
+    lisp_cleanup();
+}
+
+/*
+ * Looking up and redefining the oldest global as the number of globals grows, the rate should not drop
+ */
+void bench_globals() {
+    const int rounds = 200000;
+    clock_t t_start, t_end;
+    const char *prog;
+    char def[64], name[64];
+    cell exp, var;
+    int count = 0;
+
+    lisp_init();
+    for (int n = 10; n <= 10000; n *= 10) {
+        for (; count < n; ++count) {
+            sprintf(def, "(define global-%d %d)", count, count);
+            prog = def;
+            eval(lisp_read(&prog), global_env);
+        }
+        prog = "global-0";
+        exp = lisp_read(&prog);
+        start_timer(t_start);
+        for (int r = 0; r < rounds; ++r) {
+            eval(exp, global_env);
+        }
+        stop_timer(t_end);
+        sprintf(name, "Lookup of the oldest of %d globals", n);
+        print_rate(name, rounds, t_start, t_end);
+
+        var = exp;
+        start_timer(t_start);
+        for (int r = 0; r < rounds; ++r) {
+            define_variableb(var, nil, global_env);
+        }
+        stop_timer(t_end);
+        sprintf(name, "Redefinition of the oldest of %d globals", n);
+        print_rate(name, rounds, t_start, t_end);
+    }
+    lisp_cleanup();
+}